@@ -0,0 +1,129 @@
+// vim:noet:ts=3
+
+// Compilation of terms to the instructions of the abstract machine
+// Copyright Kostas Chatzikokolakis
+//
+// A term is compiled to a sequence of blocks. A block contains the code of
+// a term in "spine" form \x1...\xn.H A1 ... Am: the abstractions become GRAB
+// instructions, the arguments (last first) become PUSH* instructions and the
+// head H becomes ACCESS, FREE or ALIAS. If H is itself an abstraction (a redex)
+// the spine continues in its body. Arguments which are not variables or
+// aliases are compiled in their own blocks, after the current one.
+//
+// Terms must be in the locally nameless form (after termSetClosedFlag).
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include "bytecode.h"
+#include "str_intern.h"
+
+
+// argument waiting to be compiled, the offset of its PUSH instruction will be patched
+typedef struct {
+	TERM *term;
+	int push;						// position of the PUSH instruction
+} PENDING;
+
+static INSTR *buf = NULL;
+static int bufSize = 0, bufCapacity = 0;
+
+static PENDING *pending = NULL;
+static int pendingNo = 0, pendingCapacity = 0;
+
+
+static void emit(OPCODE op, INSTR operand) {
+	if(bufSize + 2 > bufCapacity) {
+		bufCapacity = bufCapacity ? 2*bufCapacity : 1000;
+		buf = realloc(buf, bufCapacity * sizeof(*buf));
+		assert(buf);
+	}
+	buf[bufSize++] = op;
+	buf[bufSize++] = operand;
+}
+
+// emits the PUSH instruction for argument t
+
+static void emitArg(TERM *t) {
+	switch(t->type) {
+	 case TM_VAR:
+		if(t->index >= 0)
+			emit(OP_PUSHVAR, t->index);
+		else
+			emit(OP_PUSHFREE, (INSTR)NAME(t));
+		return;
+
+	 case TM_ALIAS:
+		emit(OP_PUSHALIAS, (INSTR)NAME(t));
+		return;
+
+	 default:
+		// compile later, the offset is not known yet
+		if(pendingNo == pendingCapacity) {
+			pendingCapacity = pendingCapacity ? 2*pendingCapacity : 100;
+			pending = realloc(pending, pendingCapacity * sizeof(*pending));
+			assert(pending);
+		}
+		pending[pendingNo].term = t;
+		pending[pendingNo].push = bufSize;
+		pendingNo++;
+
+		emit(t->type == TM_ABSTR ? OP_PUSHFUN : OP_PUSH, 0);
+	}
+}
+
+// codeCompile
+//
+// Compiles term t, returns its code (to be freed with codeFree)
+
+CODE *codeCompile(TERM *t) {
+	char *str_tilde = str_symbol(SYM_TILDE);
+
+	bufSize = 0;
+	pendingNo = 0;
+
+	// blocks are compiled in the order they are found, first the term itself
+	for(int next = 0; t != NULL; t = next < pendingNo ? pending[next++].term : NULL) {
+		if(next > 0) {
+			// patch the PUSH instruction of this block
+			int push = pending[next-1].push;
+			buf[push+1] = bufSize - push;
+		}
+
+		// abstractions and applications (possibly redexes) until we reach the head
+		for(; t->type == TM_ABSTR || t->type == TM_APPL; t = t->type == TM_ABSTR ? RTERM(t) : LTERM(t)) {
+			if(t->type == TM_ABSTR) {
+				emit(OP_GRAB, (INSTR)NAME(t));
+			} else {
+				if(NAME(t) == str_tilde)
+					emit(OP_STRICT, 0);
+				emitArg(RTERM(t));
+			}
+		}
+
+		if(t->type == TM_ALIAS)
+			emit(OP_ALIAS, (INSTR)NAME(t));
+		else if(t->index >= 0)
+			emit(OP_ACCESS, t->index);
+		else
+			emit(OP_FREE, (INSTR)NAME(t));
+	}
+
+	CODE *code = malloc(sizeof(CODE) + bufSize * sizeof(INSTR));
+	assert(code);
+	code->size = bufSize;
+	for(int i = 0; i < bufSize; i++)
+		code->code[i] = buf[i];
+
+	free(buf);
+	free(pending);
+	buf = NULL;
+	pending = NULL;
+	bufCapacity = pendingCapacity = 0;
+
+	return code;
+}
+
+void codeFree(CODE *code) {
+	free(code);
+}
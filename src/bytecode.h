@@ -0,0 +1,43 @@
+// Declarations for bytecode.c
+// Copyright Kostas Chatzikokolakis
+
+#pragma once
+
+#include <stdint.h>
+
+#include "parser.h"
+
+
+// Instructions of the abstract machine (see machine.c). Every instruction
+// takes two words, the opcode and an operand.
+//
+//   GRAB name       abstraction: bind the next argument and continue (name is a hint for readback)
+//   ACCESS i        enter the variable with de Bruijn index i
+//   FREE name       free variable
+//   ALIAS name      enter an alias
+//   PUSH off        push as argument a suspended computation, whose code is at pc + off
+//   PUSHFUN off     same, for abstractions (which are already values)
+//   PUSHVAR i       push as argument the variable with index i (its cell is shared)
+//   PUSHFREE name   push as argument a free variable
+//   PUSHALIAS name  push as argument an alias
+//   STRICT          the next PUSH* is call-by-value (operator ~), its argument is
+//                   evaluated before continuing
+//
+// For example \f.\x.f (f x) is compiled to
+//   GRAB f; GRAB x; PUSH +4; ACCESS 1; PUSHVAR 0; ACCESS 1
+//
+typedef enum {
+	OP_GRAB, OP_ACCESS, OP_FREE, OP_ALIAS, OP_STRICT,
+	OP_PUSH, OP_PUSHFUN, OP_PUSHVAR, OP_PUSHFREE, OP_PUSHALIAS			// all PUSH* are last
+} OPCODE;
+
+typedef intptr_t INSTR;				// opcode or operand (integer, offset or interned string)
+
+typedef struct {
+	int size;						// number of words
+	INSTR code[];
+} CODE;
+
+
+CODE *codeCompile(TERM *t);
+void codeFree(CODE *code);
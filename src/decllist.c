@@ -8,10 +8,13 @@
 #include <string.h>
 #include <assert.h>
 
-#include "ADTMap.h"
 #include "decllist.h"
 #include "termproc.h"
 #include "parser.h"
+#include "bytecode.h"
+#include "lift.h"
+#include "flat.h"
+#include "symtab.h"
 #include "str_intern.h"
 
 
@@ -30,21 +33,21 @@ typedef struct {
 } GraphCycle;
 
 
-static Map declarations = NULL;		// id => TERM
-static Map operators = NULL;		// id => OPER
+// the tables are keyed by interned ids (see symtab.c)
+static SymTab *declarations = NULL;	// id => TERM, in the order they were declared
+static SymTab *lifted = NULL;		// id => TERM, declarations after termLift (frozen), lifted when first needed
+static SymTab *codes = NULL;		// id => CODE, compiled when first needed
+static SymTab *flats = NULL;		// id => FLAT_TERM, flat copies of the declarations, made when first needed
+static int lifting = 0;				// set while a declaration is lifted
+static SymTab *operators = NULL;	// id => OPER
 
 
-static TERM *getDeclarationTerm(char *id);
-
-static void findAliases(TERM *t, Vector aliases);
-static GraphCycle dfs(GraphNode *curNode, Map graph);
+static FLAT_TERM *getDeclarationFlat(char *id);
+static GraphCycle dfs(GraphNode *curNode, SymTab *graph);
 static int getCycleSize(GraphNode *start, GraphNode *end);
 static void removeCycle(GraphCycle c);
 static TERM *getIndexTerm(int varno, int n, char *tuple);
-
-static int compare_pointers(Pointer a, Pointer b) {
-	return a - b;
-}
+static void invalidateDecls();
 
 // termAddDecl
 //
@@ -55,17 +58,37 @@ void termAddDecl(char *id, TERM *term, bool freeOld) {
 	// declared term must be closed
 	assert(term->closed);
 
-	if(declarations == NULL) {
-		// strings are interned, so we can just compare them as pointers
-		declarations = map_create(compare_pointers, NULL, NULL);
-		map_set_hash_function(declarations, hash_pointer);
-	}
+	if(declarations == NULL)
+		declarations = symtab_create(NULL);
 
 	// set termFree as destroy function if we want to free old terms
-	map_set_destroy_value(declarations, freeOld ? (DestroyFunc)termFree : NULL);
+	symtab_set_destroy_value(declarations, freeOld ? (DestroyFunc)termFree : NULL);
+
+	// if a declaration with this id exists, it will be replaced (keeping its position)
+	symtab_insert(declarations, id, term);
+
+	if(flats != NULL)
+		symtab_remove(flats, id);
+
+	// lifted declarations might depend on this one (through their normalized
+	// subterms), so all of them are lifted again when needed
+	invalidateDecls();
+}
+
+// invalidateDecls
+//
+// Discards the lifted and compiled declarations, called when declarations change
 
-	// if a declaration with this id exists, it will be replaced
-	map_insert(declarations, id, term);
+static void invalidateDecls() {
+	if(lifted != NULL) {
+		symtab_destroy(lifted);
+		lifted = NULL;
+		termConsClear();			// no frozen term uses them now
+	}
+	if(codes != NULL) {
+		symtab_destroy(codes);
+		codes = NULL;
+	}
 }
 
 // getDeclarationTerm
@@ -73,12 +96,72 @@ void termAddDecl(char *id, TERM *term, bool freeOld) {
 // Returns the term corresponding to the declaration with
 // the given (interned) id, or NULL if there is no such declaration.
 
-static TERM *getDeclarationTerm(char *id) {
+TERM *getDeclarationTerm(char *id) {
 	return declarations  != NULL
-		? map_find(declarations, id)
+		? symtab_find(declarations, id)
 		: NULL;
 }
 
+// getDeclarationCode
+//
+// Returns the compiled code of the declaration with the given (interned) id,
+// or NULL if there is no such declaration. The declaration is compiled the
+// first time its code is requested.
+
+CODE *getDeclarationCode(char *id) {
+	CODE *code = codes != NULL ? symtab_find(codes, id) : NULL;
+	if(code != NULL)
+		return code;
+
+	TERM *term = getLiftedTerm(id);
+	if(term == NULL)
+		return NULL;
+
+	if(codes == NULL)
+		codes = symtab_create((DestroyFunc)codeFree);
+
+	code = codeCompile(term);
+	symtab_insert(codes, id, code);
+	return code;
+}
+
+// getLiftedTerm
+//
+// Returns the declaration with the given (interned) id after lifting its
+// closed subterms (see lift.c), or NULL if there is no such declaration.
+// The id can also be one of the aliases created by termLift. The declaration
+// is lifted the first time it is requested.
+
+TERM *getLiftedTerm(char *id) {
+	TERM *term = lifted != NULL ? symtab_find(lifted, id) : NULL;
+	if(term != NULL)
+		return term;
+
+	// while lifting, normalized subterms use the declarations as they are
+	if((term = getDeclarationTerm(id)) == NULL || lifting)
+		return term;
+
+	if(lifted == NULL)
+		lifted = symtab_create((DestroyFunc)termThaw);
+
+	SymTab *aliases = symtab_create(NULL);		// the aliases created by termLift
+
+	lifting = 1;
+	term = termClone(term);
+	termLift(id, term, aliases);
+	lifting = 0;
+
+	// the lifted terms are frozen, expanding them copies only what is modified
+	for(int pos = symtab_first(aliases); pos != SYMTAB_EOF; pos = symtab_next(aliases, pos))
+		symtab_insert(lifted, symtab_id(aliases, pos), termFreeze(symtab_value(aliases, pos)));
+	symtab_destroy(aliases);
+
+	term = termFreeze(term);
+	symtab_insert(lifted, id, term);
+
+	return term;
+}
+
 // termFromDecl
 //
 // Returns a clone of the term stored with the given id
@@ -91,29 +174,23 @@ TERM *termFromDecl(char *id) {
 		: NULL;
 }
 
-// findAliases
+// getDeclarationFlat
 //
-// Finds all aliases used by term t and adds them to 'aliases'
-
-static void findAliases(TERM *t, Vector aliases) {
-	switch(t->type) {
-	 case TM_VAR:
-		return;
-
-	 case TM_ALIAS:
-		if(!vector_find(aliases, t->name, compare_pointers))
-			vector_insert_last(aliases, t->name);
-		return;
-
-	 case TM_ABSTR:
-		findAliases(t->rterm, aliases);
-		return;
-
-	 case TM_APPL:
-		findAliases(t->lterm, aliases);
-		findAliases(t->rterm, aliases);
-		return;
-	}
+// Returns the flat copy (see flat.c) of the declaration with the given
+// (interned) id, which must exist. The copy is made the first time it is
+// requested, and removed when the declaration is replaced or modified.
+
+static FLAT_TERM *getDeclarationFlat(char *id) {
+	FLAT_TERM *flat = flats != NULL ? symtab_find(flats, id) : NULL;
+	if(flat != NULL)
+		return flat;
+
+	if(flats == NULL)
+		flats = symtab_create((DestroyFunc)flatFree);
+
+	flat = flatNew(getDeclarationTerm(id));
+	symtab_insert(flats, id, flat);
+	return flat;
 }
 
 void printCycle(GraphNode *start, GraphNode *end) {
@@ -130,12 +207,10 @@ static void destroy_graph_node(Pointer n) {
 
 int findAndRemoveCycle() {
 	// create the graph
-	Map graph = map_create(compare_pointers, NULL, destroy_graph_node);		// id => GraphNode
-	map_set_hash_function(graph, hash_pointer);
+	SymTab *graph = symtab_create(destroy_graph_node);		// id => GraphNode
 
-	for(MapNode node = map_first(declarations); node != MAP_EOF; node = map_next(declarations, node)) {
-		char *id = map_node_key(declarations, node);
-		TERM *term = map_node_value(declarations, node);
+	for(int pos = symtab_first(declarations); pos != SYMTAB_EOF; pos = symtab_next(declarations, pos)) {
+		char *id = symtab_id(declarations, pos);
 
 		GraphNode *node = malloc(sizeof(GraphNode));
 		node->id = id;
@@ -143,16 +218,16 @@ int findAndRemoveCycle() {
 		node->prev = NULL;
 		node->neighbours = vector_create(0, NULL);		// vector of ids
 
-		findAliases(term, node->neighbours);
+		flatNames(getDeclarationFlat(id), TM_ALIAS, node->neighbours);		// the aliases it uses
 
-		map_insert(graph, id, node);
+		symtab_insert(graph, id, node);
 	}
 
 	// DFS might need to be executed multiple times if the graph is not connected
 	GraphCycle bestCycle = { .size = 0 };
 
-	for(MapNode map_node = map_first(graph); map_node != MAP_EOF; map_node = map_next(graph, map_node)) {
-		GraphNode *node = map_node_value(graph, map_node);
+	for(int pos = symtab_first(graph); pos != SYMTAB_EOF; pos = symtab_next(graph, pos)) {
+		GraphNode *node = symtab_value(graph, pos);
 		if(node->flag == 0) {
 			GraphCycle newCycle = dfs(node, graph);
 			if(newCycle.size > bestCycle.size)
@@ -160,16 +235,19 @@ int findAndRemoveCycle() {
 		}
 	}
 
-	// if a cycle was found, remove it
+	// if a cycle was found, remove it. Declarations are modified in place, so
+	// their lifted terms and code are not valid anymore.
 	int res = 0;
 	if(bestCycle.size > 0) {
+		invalidateDecls();
+
 		//printf("best cycle size: %d\n", bestCycle.size);
 		//printCycle(bestCycle.start, bestCycle.end);
 		removeCycle(bestCycle);
 		res = 1;
 	}
 
-	map_destroy(graph);
+	symtab_destroy(graph);
 
 	return res;
 }
@@ -179,7 +257,7 @@ int findAndRemoveCycle() {
 // Depth first search for finding cycles. Finds and returns a maximal
 // cycle, i.e. one not contained in some other cycle.
 
-static GraphCycle dfs(GraphNode *curNode, Map graph) {
+static GraphCycle dfs(GraphNode *curNode, SymTab *graph) {
 	GraphCycle bestCycle, newCycle;
 	int curSize;
 
@@ -190,7 +268,7 @@ static GraphCycle dfs(GraphNode *curNode, Map graph) {
 	// process neighborhoods
 	for(int i = 0; i < vector_size(curNode->neighbours); i++) {
 		char *newNode_id = vector_get_at(curNode->neighbours, i);
-		GraphNode *newNode = map_find(graph, newNode_id);
+		GraphNode *newNode = symtab_find(graph, newNode_id);
 
 		if(!newNode) // if the alias is not defined, ignore it
 			continue;
@@ -283,9 +361,14 @@ static void removeCycle(GraphCycle cycle) {
 			termAddDecl(tmpId, tmpTerm, true);		// free the old terms, we got clones from termRemoveAliases
 
 			// replace this specific alias with its definition in the whole program
-			for(MapNode node = map_first(declarations); node != MAP_EOF; node = map_next(declarations, node)) {
-				TERM *term = map_node_value(declarations, node);
-				termRemoveAliases(term, tmpId);
+			// (only in the declarations that use it, they are found by a scan)
+			for(int pos = symtab_first(declarations); pos != SYMTAB_EOF; pos = symtab_next(declarations, pos)) {
+				char *id = symtab_id(declarations, pos);
+				if(flatCount(getDeclarationFlat(id), TM_ALIAS, tmpId) == 0)
+					continue;
+
+				termRemoveAliases(symtab_value(declarations, pos), tmpId);
+				symtab_remove(flats, id);			// modified in place
 			}
 		}
 	} else {
@@ -296,21 +379,21 @@ static void removeCycle(GraphCycle cycle) {
 	// To remove recursion, appearances of the alias within its body are replaced with the
 	// variable _me and we add a fixed point combinator.
 	// Hence the term A=N becomes A=Y \_me.N[A:=_me]
-	termAlias2Var(t, newId, str_intern("_me"));						// Change alias to _me
+	termAlias2Var(t, newId, str_symbol(SYM_ME));						// Change alias to _me
 
 	TERM *newTerm = termNew();										// Application of Y to the term
 	newTerm->type = TM_APPL;
-	newTerm->name = NULL;
+	SET_NAME(newTerm, NULL);
 
-	newTerm->lterm = termNew();								// Y
-	newTerm->lterm->type = TM_ALIAS;
-	newTerm->lterm->name = str_intern("Y");
+	SET_LTERM(newTerm, termNew());								// Y
+	LTERM(newTerm)->type = TM_ALIAS;
+	SET_NAME(LTERM(newTerm), str_symbol(SYM_Y));
 
-	newTerm->rterm = termNew();								// Remove \_me.
-	TERM *tmpTerm = newTerm->rterm;
+	SET_RTERM(newTerm, termNew());								// Remove \_me.
+	TERM *tmpTerm = RTERM(newTerm);
 	tmpTerm->type = TM_ABSTR;
-	tmpTerm->name = str_intern("_me");					// _me variable
-	tmpTerm->rterm = t;
+	SET_NAME(tmpTerm, str_symbol(SYM_ME));					// _me variable
+	SET_RTERM(tmpTerm, t);
 
 	// Change declaration
 	termSetClosedFlag(newTerm);
@@ -353,9 +436,9 @@ void printDeclList(char *id) {
 			printf("\n");
 		}
 	} else {
-		for(MapNode node = map_first(declarations); node != MAP_EOF; node = map_next(declarations, node)) {
-			char *id = map_node_key(declarations, node);
-			TERM *term = map_node_value(declarations, node);
+		for(int pos = symtab_first(declarations); pos != SYMTAB_EOF; pos = symtab_next(declarations, pos)) {
+			char *id = symtab_id(declarations, pos);
+			TERM *term = symtab_value(declarations, pos);
 
 			printf("%s = ", id);
 			termPrint(term, 1);
@@ -370,7 +453,7 @@ void printDeclList(char *id) {
 
 OPER *getOper(char *id) {
 	return operators != NULL
-		? map_find(operators, id)
+		? symtab_find(operators, id)
 		: NULL;
 }
 
@@ -380,11 +463,8 @@ OPER *getOper(char *id) {
 
 void addOper(char *id, int preced, ASS_TYPE assoc) {
 
-	if(operators == NULL) {
-		// strings are interned, so we can just compare them as pointers
-		operators = map_create(compare_pointers, NULL, free);
-		map_set_hash_function(operators, hash_pointer);
-	}
+	if(operators == NULL)
+		operators = symtab_create(free);
 
 	// if id is already registered we replace
 	OPER *op = getOper(id);
@@ -392,7 +472,7 @@ void addOper(char *id, int preced, ASS_TYPE assoc) {
 		// not found, create new
 		op = malloc(sizeof(OPER));
 		op->id = id;
-		map_insert(operators, id, op);
+		symtab_insert(operators, id, op);
 	}
 
 	op->preced = preced;
@@ -402,22 +482,28 @@ void addOper(char *id, int preced, ASS_TYPE assoc) {
 Vector decl_get_ids() {
 	Vector res = vector_create(0, NULL);
 
-	for(MapNode node = map_first(declarations); node != MAP_EOF; node = map_next(declarations, node)) {
-		char *id = map_node_key(declarations, node);
-		vector_insert_last(res, id);
-	}
+	if(declarations != NULL)
+		for(int pos = symtab_first(declarations); pos != SYMTAB_EOF; pos = symtab_next(declarations, pos))
+			vector_insert_last(res, symtab_id(declarations, pos));
 	return res;
 }
 
 void decl_cleanup() {
 	if(declarations != NULL) {
-		map_set_destroy_value(declarations, (DestroyFunc)termFree);		// we want to free
-		map_destroy(declarations);
+		symtab_set_destroy_value(declarations, (DestroyFunc)termFree);		// we want to free
+		symtab_destroy(declarations);
 		declarations = NULL;
 	}
 
+	invalidateDecls();
+
+	if(flats != NULL) {
+		symtab_destroy(flats);
+		flats = NULL;
+	}
+
 	if(operators != NULL) {
-		map_destroy(operators);
+		symtab_destroy(operators);
 		operators = NULL;
 	}
 }
\ No newline at end of file
@@ -5,6 +5,7 @@
 
 #include "ADTVector.h"
 #include "parser.h"
+#include "bytecode.h"
 
 
 typedef struct tag_oper{ 
@@ -16,6 +17,9 @@ typedef struct tag_oper{
 
 void termAddDecl(char *id, TERM *term, bool freeOld);
 TERM *termFromDecl(char *id);
+TERM *getDeclarationTerm(char *id);
+TERM *getLiftedTerm(char *id);
+CODE *getDeclarationCode(char *id);
 
 int findAndRemoveCycle();
 
@@ -0,0 +1,279 @@
+// vim:noet:ts=3
+
+// Compilation of lci programs to C
+// Copyright Kostas Chatzikokolakis
+//
+// lci --emit-c file [query] consults file as usual, except that the terms to
+// be executed (those which are not system commands) are not executed but
+// kept, together with the options in effect at that point. Then a C program is
+// written to the standard output, containing all declarations and kept terms
+// as static data, already parsed and in the locally nameless form.
+//
+// The generated program is linked with the rest of lci except main.c (the
+// lcirt library, see CMakeLists.txt). Its main function calls emitRun, which
+// rebuilds the declarations and executes the terms with execTerm, so the
+// output is the same as lci's, but the program has nothing to parse.
+//
+// System commands are executed while consulting, so their output is captured
+// (stdout goes to a temporary file until emitEnd) and kept in order with the
+// terms, for the generated program to print it again.
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include "ADTVector.h"
+
+#include "emit.h"
+#include "termproc.h"
+#include "decllist.h"
+#include "str_intern.h"
+
+
+// a kept term with its options, or some output of the system commands
+typedef struct {
+	TERM *term;
+	int options[OPTNO];
+	char *output;						// NULL for terms
+} QUERY;
+
+static Vector queries = NULL;			// QUERY, in the order they were read
+
+static FILE *captured = NULL;			// receives stdout until emitEnd
+static int savedStdout = -1;			// the original stdout
+static long keptOutput = 0;			// the output up to here is already in queries
+
+
+static void freeQuery(QUERY *q) {
+	if(q->term)
+		termFree(q->term);
+	free(q->output);
+	free(q);
+}
+
+// Keeps the output printed since the last call as a query
+
+static void keepOutput() {
+	fflush(stdout);
+	long end = lseek(STDOUT_FILENO, 0, SEEK_END);
+	if(end <= keptOutput)
+		return;
+
+	QUERY *q = calloc(1, sizeof(QUERY));
+	assert(q);
+	q->output = malloc(end - keptOutput + 1);
+	assert(q->output);
+
+	lseek(STDOUT_FILENO, keptOutput, SEEK_SET);
+	long n = read(STDOUT_FILENO, q->output, end - keptOutput);
+	q->output[n > 0 ? n : 0] = '\0';
+	lseek(STDOUT_FILENO, end, SEEK_SET);
+	keptOutput = end;
+
+	vector_insert_last(queries, q);
+}
+
+// emitBegin
+//
+// From now on, terms passed to execTerm are kept for emitProgram instead of
+// executed, and the output is captured
+
+void emitBegin() {
+	queries = vector_create(0, (DestroyFunc)freeQuery);
+
+	fflush(stdout);
+	captured = tmpfile();
+	assert(captured);
+	savedStdout = dup(STDOUT_FILENO);
+	dup2(fileno(captured), STDOUT_FILENO);
+	keptOutput = 0;
+}
+
+// emitEnd
+//
+// Stops capturing the output, stdout is restored
+
+void emitEnd() {
+	keepOutput();
+	dup2(savedStdout, STDOUT_FILENO);
+	close(savedStdout);
+	fclose(captured);
+	captured = NULL;
+}
+
+// emitCapture
+//
+// Called by execTerm for terms that are not system commands. Returns 1 if
+// the term was kept (a copy of it), 0 if it should be executed.
+
+int emitCapture(TERM *t) {
+	if(queries == NULL)
+		return 0;
+
+	// the output of the commands before t comes first
+	keepOutput();
+
+	QUERY *q = malloc(sizeof(QUERY));
+	assert(q);
+	q->term = termClone(t);
+	q->output = NULL;
+	for(int i = 0; i < OPTNO; i++)
+		q->options[i] = getOption(i);
+
+	vector_insert_last(queries, q);
+	return 1;
+}
+
+// Writes str as a C string literal
+
+static void emitString(FILE *out, char *str) {
+	if(str == NULL) {
+		fprintf(out, "NULL");
+		return;
+	}
+
+	fputc('"', out);
+	for(; *str; str++) {
+		// escape also '?', to avoid trigraphs
+		if(*str == '\\' || *str == '"' || *str == '?')
+			fputc('\\', out);
+		if(*str == '\n')
+			fprintf(out, "\\n");
+		else if((unsigned char)*str < ' ')
+			fprintf(out, "\\%03o", (unsigned char)*str);
+		else
+			fputc(*str, out);
+	}
+	fputc('"', out);
+}
+
+// Writes the nodes of t in preorder
+
+static void emitNodes(FILE *out, TERM *t) {
+	static const char *types[] = { "TM_ABSTR", "TM_APPL", "TM_VAR", "TM_ALIAS" };
+	assert(t->type != TM_SUBST);
+
+	fprintf(out, "\t{ %s, %d, %d, ", types[t->type], t->closed, t->index);
+	emitString(out, NAME(t));
+	fprintf(out, " },\n");
+
+	if(t->type == TM_APPL)
+		emitNodes(out, LTERM(t));
+	if(t->type == TM_APPL || t->type == TM_ABSTR)
+		emitNodes(out, RTERM(t));
+}
+
+// emitProgram
+//
+// Writes to out a C program containing all declarations and the terms kept
+// since emitBegin, which are then released. Called after emitEnd.
+
+void emitProgram(FILE *out) {
+	assert(queries != NULL && captured == NULL);
+
+	// sort the declarations, so that the output does not depend on the hash table
+	Vector ids = decl_get_ids();
+	vector_sort(ids, (CompareFunc)strcmp);
+
+	fprintf(out, "// Generated by lci --emit-c, link with lcirt\n\n");
+	fprintf(out, "#include \"emit.h\"\n\n");
+
+	for(int i = 0; i < vector_size(ids); i++) {
+		fprintf(out, "static const EMIT_NODE decl%d[] = {\n", i);
+		emitNodes(out, getDeclarationTerm(vector_get_at(ids, i)));
+		fprintf(out, "};\n\n");
+	}
+
+	for(int i = 0; i < vector_size(queries); i++) {
+		QUERY *q = vector_get_at(queries, i);
+		if(q->output)
+			continue;
+
+		fprintf(out, "static const int options%d[] = {", i);
+		for(int j = 0; j < OPTNO; j++)
+			fprintf(out, j == 0 ? " %d" : ", %d", q->options[j]);
+		fprintf(out, " };\n\n");
+
+		fprintf(out, "static const EMIT_NODE query%d[] = {\n", i);
+		emitNodes(out, q->term);
+		fprintf(out, "};\n\n");
+	}
+
+	// an empty initializer is not valid C, the lists always have an extra entry
+	fprintf(out, "static const EMIT_DECL decls[] = {\n");
+	for(int i = 0; i < vector_size(ids); i++) {
+		fprintf(out, "\t{ ");
+		emitString(out, vector_get_at(ids, i));
+		fprintf(out, ", decl%d },\n", i);
+	}
+	fprintf(out, "\t{ NULL, NULL }\n};\n\n");
+
+	fprintf(out, "static const EMIT_QUERY queries[] = {\n");
+	for(int i = 0; i < vector_size(queries); i++) {
+		QUERY *q = vector_get_at(queries, i);
+		if(q->output) {
+			fprintf(out, "\t{ NULL, NULL, ");
+			emitString(out, q->output);
+			fprintf(out, " },\n");
+		} else {
+			fprintf(out, "\t{ options%d, query%d, NULL },\n", i, i);
+		}
+	}
+	fprintf(out, "\t{ NULL, NULL, NULL }\n};\n\n");
+
+	fprintf(out, "int main() {\n");
+	fprintf(out, "\tEMIT_PROGRAM prog = { decls, %d, queries, %d };\n", vector_size(ids), vector_size(queries));
+	fprintf(out, "\treturn emitRun(&prog);\n");
+	fprintf(out, "}\n");
+
+	vector_destroy(ids);
+	vector_destroy(queries);
+	queries = NULL;
+}
+
+// Builds a term from its nodes, node is advanced after the last one
+
+static TERM *loadTerm(const EMIT_NODE **node) {
+	const EMIT_NODE *n = (*node)++;
+
+	TERM *t = termNew();
+	t->type = n->type;
+	t->closed = n->closed;
+	t->index = n->index;
+	SET_NAME(t, n->name ? str_intern((char*)n->name) : NULL);
+	SET_LTERM(t, n->type == TM_APPL ? loadTerm(node) : NULL);
+	SET_RTERM(t, n->type == TM_APPL || n->type == TM_ABSTR ? loadTerm(node) : NULL);
+	termUpdateFree(t);					// the free mask is not kept in the nodes
+	return t;
+}
+
+// emitRun
+//
+// Runs a program generated by emitProgram
+
+int emitRun(const EMIT_PROGRAM *prog) {
+	for(int i = 0; i < prog->declNo; i++) {
+		const EMIT_NODE *node = prog->decls[i].term;
+		termAddDecl(str_intern((char*)prog->decls[i].id), loadTerm(&node), true);
+	}
+
+	for(int i = 0; i < prog->queryNo; i++) {
+		if(prog->queries[i].output) {
+			fputs(prog->queries[i].output, stdout);
+			continue;
+		}
+
+		for(int j = 0; j < OPTNO; j++)
+			setOption(j, prog->queries[i].options[j]);
+
+		const EMIT_NODE *node = prog->queries[i].term;
+		execTerm(loadTerm(&node));
+	}
+
+	decl_cleanup();
+	termFreeAll();
+	str_intern_cleanup();
+
+	return 0;
+}
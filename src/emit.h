@@ -0,0 +1,48 @@
+// Declarations for emit.c
+// Copyright Kostas Chatzikokolakis
+
+#pragma once
+
+#include <stdio.h>
+
+#include "parser.h"
+#include "run.h"
+
+
+// The structures below describe a program generated by lci --emit-c. Terms
+// are stored as arrays of nodes in preorder (an application is followed by
+// its left and right subterm, an abstraction by its body).
+
+typedef struct {
+	TERM_TYPE type;
+	char closed;
+	int index;
+	const char *name;
+} EMIT_NODE;
+
+typedef struct {
+	const char *id;
+	const EMIT_NODE *term;
+} EMIT_DECL;
+
+// A term to execute, or the output of some system commands to print
+typedef struct {
+	const int *options;				// OPTNO values, in effect when the query was read
+	const EMIT_NODE *term;
+	const char *output;				// NULL for terms
+} EMIT_QUERY;
+
+typedef struct {
+	const EMIT_DECL *decls;
+	int declNo;
+	const EMIT_QUERY *queries;
+	int queryNo;
+} EMIT_PROGRAM;
+
+
+void emitBegin();
+void emitEnd();
+int emitCapture(TERM *t);
+void emitProgram(FILE *out);
+
+int emitRun(const EMIT_PROGRAM *prog);
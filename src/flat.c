@@ -0,0 +1,103 @@
+// vim:noet:ts=3
+
+// Terms stored as arrays of nodes
+// Copyright Kostas Chatzikokolakis
+//
+// Analyses of the declarations which look at every node (eg. finding the
+// aliases used by a declaration, or whether it uses a specific one) are done
+// repeatedly while removing cycles, and walking the trees visits scattered
+// nodes one at a time. A FLAT_TERM keeps the type and name of the nodes in two
+// arrays instead, so such an analysis is a linear scan, simple enough for the
+// compiler to vectorize. The tree structure is not needed by the scans and is
+// not kept.
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include "flat.h"
+#include "str_intern.h"
+
+
+static int compare_pointers(Pointer a, Pointer b) {
+	return a - b;
+}
+
+// Appends the nodes of t in preorder, growing the arrays when needed
+
+static void flatAdd(FLAT_TERM *f, int *capacity, TERM *t) {
+	assert(t->type != TM_SUBST);			// closures only exist during execution
+
+	if(f->size == *capacity) {
+		*capacity *= 2;
+		f->type = realloc(f->type, *capacity * sizeof(*f->type));
+		f->name = realloc(f->name, *capacity * sizeof(*f->name));
+		assert(f->type && f->name);
+	}
+
+	f->type[f->size] = t->type;
+	f->name[f->size] = str_intern_id(NAME(t));
+	f->size++;
+
+	if(t->type == TM_APPL)
+		flatAdd(f, capacity, LTERM(t));
+	if(t->type == TM_APPL || t->type == TM_ABSTR)
+		flatAdd(f, capacity, RTERM(t));
+}
+
+// flatNew
+//
+// Returns a flat copy of t. Later changes of t are not reflected in it.
+
+FLAT_TERM *flatNew(TERM *t) {
+	FLAT_TERM *f = malloc(sizeof(FLAT_TERM));
+	assert(f);
+
+	int capacity = 64;
+	f->size = 0;
+	f->type = malloc(capacity * sizeof(*f->type));
+	f->name = malloc(capacity * sizeof(*f->name));
+	assert(f->type && f->name);
+
+	flatAdd(f, &capacity, t);
+	return f;
+}
+
+void flatFree(FLAT_TERM *f) {
+	free(f->type);
+	free(f->name);
+	free(f);
+}
+
+// flatCount
+//
+// Returns the number of nodes of the given type and (interned) name,
+// eg. the occurrences of an alias
+
+int flatCount(FLAT_TERM *f, TERM_TYPE type, char *name) {
+	uint8_t *types = f->type;
+	uint32_t *names = f->name;
+	uint32_t id = str_intern_id(name);
+	int count = 0;
+
+	// no branches, so that the loop is vectorized
+	for(int i = 0; i < f->size; i++)
+		count += (types[i] == type) & (names[i] == id);
+
+	return count;
+}
+
+// flatNames
+//
+// Adds to 'names' the (interned) names of the nodes of the given type,
+// each name once, eg. the aliases used by a term
+
+void flatNames(FLAT_TERM *f, TERM_TYPE type, Vector names) {
+	for(int i = 0; i < f->size; i++) {
+		if(f->type[i] != type)
+			continue;
+
+		char *name = str_intern_name(f->name[i]);
+		if(!vector_find(names, name, compare_pointers))
+			vector_insert_last(names, name);
+	}
+}
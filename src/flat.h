@@ -0,0 +1,27 @@
+// Declarations for flat.c
+// Copyright Kostas Chatzikokolakis
+
+#pragma once
+
+#include <stdint.h>
+
+#include "ADTVector.h"
+#include "parser.h"
+
+
+// A read-only copy of a term as parallel arrays of its nodes in preorder (an
+// application is followed by its left and right subterm, an abstraction by
+// its body). Names are stored as str_intern ids.
+
+typedef struct {
+	int size;							// number of nodes
+	uint8_t *type;						// TERM_TYPE of each node
+	uint32_t *name;					// id of the name of each node (0 if NULL)
+} FLAT_TERM;
+
+
+FLAT_TERM *flatNew(TERM *t);
+void flatFree(FLAT_TERM *f);
+
+int flatCount(FLAT_TERM *f, TERM_TYPE type, char *name);
+void flatNames(FLAT_TERM *f, TERM_TYPE type, Vector names);
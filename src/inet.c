@@ -0,0 +1,922 @@
+// vim:noet:ts=3
+
+// Optimal reduction using interaction nets
+// Copyright Kostas Chatzikokolakis
+//
+// termConv and the abstract machine copy the body of an abstraction each time
+// it is applied, so work done inside a shared abstraction (eg. a Church numeral
+// used twice) is repeated by each copy. Here the term is translated to an
+// interaction net, a graph in which copying is itself done step by step by
+// "fan" nodes. A fan stops copying at redexes, which are then shared by all
+// copies and reduced only once (Lamping's optimal reduction).
+//
+// The net consists of nodes with one principal and some auxiliary ports.
+// Two nodes whose principal ports are connected form an active pair, which is
+// rewritten by a local rule: an abstraction and an application are
+// annihilated (beta-reduction), a fan meeting another node copies it, and so
+// on. Fans coming from different copies must not be confused, so all nodes
+// carry a level and, following Gonthier, Abadi and Levy, the arguments of
+// applications are one level higher than the applications. The free variables
+// of an argument enter it through "brackets" and each occurrence of a variable
+// leaves through a "croissant", which increase and decrease the level of the
+// nodes passing through them. Only fans of the same level annihilate each other.
+//
+// Reduction is lazy: starting from the root, we follow the path of nodes
+// whose principal port is needed, and rewrite only the active pairs found on
+// it (so terms like "True I Loop" terminate). The normal form is read back in
+// the same way, building a new term.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "inet.h"
+#include "termproc.h"
+#include "decllist.h"
+#include "run.h"
+
+
+// Ports of the nodes. Port 0 is always the principal one.
+//
+//   LAM        0: the abstraction   1: body        2: variable
+//   APP        0: function          1: argument    2: result
+//   FAN        0: principal         1, 2: the two copies
+//   BRACKET    0: outside           1: inside of an argument
+//   CROISSANT  0: variable          1: occurrence
+//   ERA        0: eraser, for unused variables and discarded parts of the net
+//   VAR        0: free variable
+//   ALIAS      0: alias, translated to a net when needed
+//   ROOT       0: the whole term (not a principal port)
+//
+// FAN, BRACKET and CROISSANT are the control nodes, they only move
+// information around.
+
+typedef enum {
+	N_UNUSED, N_ROOT, N_LAM, N_APP, N_FAN, N_BRACKET, N_CROISSANT, N_ERA, N_VAR, N_ALIAS
+} NODE_TYPE;
+
+static const int auxPorts[] = { 0, 0, 2, 2, 2, 1, 1, 0, 0, 0 };
+static const int levelChange[] = { 0, 0, 0, 0, 0, 1, -1, 0, 0, 0 };
+
+#define IS_CONTROL(type)	((type) >= N_FAN && (type) <= N_CROISSANT)
+
+typedef uint32_t PORT;				// node index and port number
+
+#define PORT_OF(n, s)	((PORT)(n) << 2 | (s))
+#define NODE_OF(p)		((int)((p) >> 2))
+#define SLOT_OF(p)		((int)((p) & 3))
+
+typedef struct {
+	PORT port[3];					// connected port of each port
+	int level;
+	int uses;						// LAM: occurrences of the variable during readback, -1 if not read back
+	char *name;						// LAM: name of the variable, VAR, ALIAS: name, APP: operator ~ or NULL
+	char type;						// NODE_TYPE
+} NODE;
+
+// Contexts
+//
+// A fan met from one of its copies and a fan met from its principal port must
+// be paired: while following a path we push the copy we come from, and pop it
+// to choose the copy we go to. There is a separate stack for each level.
+// Leaving an argument through a bracket merges the stacks of two levels into
+// one (a pair), entering it splits them. Leaving an occurrence through a
+// croissant inserts a new level, entering it removes the level. Only the
+// non-empty levels are stored, in increasing order, each one relative to the
+// previous (so that moving the levels after some point changes a single
+// entry). Contexts are never modified, so older ones can be kept for
+// backtracking.
+
+typedef struct stack {
+	int copy;							// copy of a fan (1, 2), 0 for a pair
+	struct stack *first, *second;	// pair: the stacks of two merged levels
+	struct stack *next;
+} STACK;
+
+typedef struct ctx {
+	int gap;							// level minus the level of the previous entry
+	STACK *stack;
+	struct ctx *next;
+} CTX;
+
+// step of the path followed by whnf
+typedef struct {
+	PORT host;
+	CTX *ctx;
+} STEP;
+
+// occurrence of a variable during the translation: the variable of the
+// abstraction at position binder of frames, used by port
+typedef struct {
+	int binder;
+	PORT port;
+} USE;
+
+typedef struct {
+	int node;						// the abstraction
+	int uses;						// its uses start here
+} FRAME;
+
+#define ARENA_BLOCK 4096
+
+typedef struct block {
+	char data[ARENA_BLOCK];
+	struct block *next;
+	int used;
+} BLOCK;
+
+
+static NODE *nodes = NULL;
+static int nodeNo = 0, nodeCapacity = 0;
+static int freeNodes = -1;			// unused nodes, linked through port[0]
+
+static STEP *steps = NULL;
+static int stepNo = 0, stepCapacity = 0;
+
+static USE *uses = NULL;
+static int useNo = 0, useCapacity = 0;
+
+static FRAME *frames = NULL;
+static int frameNo = 0, frameCapacity = 0;
+
+static int *erasers = NULL;		// erasers connected by a rule, which may face a principal port
+static int eraserNo = 0, eraserCapacity = 0;
+
+static BLOCK *blocks = NULL, *block = NULL;	// contexts live until the next whnf
+
+static uint64_t reductions;
+static int error;
+
+
+static int newNode(NODE_TYPE type, int level) {
+	int n;
+	if(freeNodes >= 0) {
+		n = freeNodes;
+		freeNodes = nodes[n].port[0];
+	} else {
+		if(nodeNo == nodeCapacity) {
+			nodeCapacity = nodeCapacity ? 2*nodeCapacity : 1024;
+			nodes = realloc(nodes, nodeCapacity * sizeof(*nodes));
+			assert(nodes);
+		}
+		n = nodeNo++;
+	}
+
+	nodes[n].type = type;
+	nodes[n].level = level;
+	nodes[n].uses = -1;
+	nodes[n].name = NULL;
+	return n;
+}
+
+static void freeNode(int n) {
+	nodes[n].type = N_UNUSED;
+	nodes[n].port[0] = freeNodes;
+	freeNodes = n;
+}
+
+static inline PORT peer(PORT p) {
+	return nodes[NODE_OF(p)].port[SLOT_OF(p)];
+}
+
+static inline void wire(PORT a, PORT b) {
+	nodes[NODE_OF(a)].port[SLOT_OF(a)] = b;
+	nodes[NODE_OF(b)].port[SLOT_OF(b)] = a;
+}
+
+static inline int isPrincipal(PORT p) {
+	return SLOT_OF(p) == 0 && nodes[NODE_OF(p)].type != N_ROOT;
+}
+
+static void *arenaAlloc(int size) {
+	if(block == NULL || block->used + size > ARENA_BLOCK) {
+		BLOCK *next = block ? block->next : blocks;
+		if(next == NULL) {
+			next = malloc(sizeof(BLOCK));
+			assert(next);
+			next->next = NULL;
+			if(block)
+				block->next = next;
+			else
+				blocks = next;
+		}
+		block = next;
+		block->used = 0;
+	}
+
+	void *res = block->data + block->used;
+	block->used += size;
+	return res;
+}
+
+static STACK *newStack(int copy, STACK *first, STACK *second, STACK *next) {
+	STACK *s = arenaAlloc(sizeof(STACK));
+	s->copy = copy;
+	s->first = first;
+	s->second = second;
+	s->next = next;
+	return s;
+}
+
+// In the following, levels are relative to the level before ctx
+
+static STACK *ctxGet(CTX *ctx, int level) {
+	for(; ctx != NULL && ctx->gap < level; ctx = ctx->next)
+		level -= ctx->gap;
+	return ctx != NULL && ctx->gap == level ? ctx->stack : NULL;
+}
+
+static CTX *ctxNew(int gap, STACK *s, CTX *next) {
+	CTX *res = arenaAlloc(sizeof(CTX));
+	res->gap = gap;
+	res->stack = s;
+	res->next = next;
+	return res;
+}
+
+// Returns ctx with the stack of the given level replaced by s
+
+static CTX *ctxSet(CTX *ctx, int level, STACK *s) {
+	if(ctx != NULL && ctx->gap < level)
+		return ctxNew(ctx->gap, ctx->stack, ctxSet(ctx->next, level - ctx->gap, s));
+
+	// the entries after the given level (their first one is now relative to it)
+	CTX *rest = ctx;
+	if(ctx != NULL && ctx->gap == level)
+		rest = ctx->next ? ctxNew(ctx->next->gap + level, ctx->next->stack, ctx->next->next) : NULL;
+
+	if(s == NULL)
+		return rest;
+	return ctxNew(level, s, rest ? ctxNew(rest->gap - level, rest->stack, rest->next) : NULL);
+}
+
+// Returns ctx with the levels >= from moved by delta
+
+static CTX *ctxShift(CTX *ctx, int from, int delta) {
+	if(ctx == NULL)
+		return NULL;
+	if(ctx->gap >= from)
+		return ctxNew(ctx->gap + delta, ctx->stack, ctx->next);
+	return ctxNew(ctx->gap, ctx->stack, ctxShift(ctx->next, from - ctx->gap, delta));
+}
+
+// Pops the copy at the top of the stack of the given level, and stores the
+// new context in res. Returns 0 if there is no copy there.
+
+static int ctxPop(CTX *ctx, int level, int *copy, CTX **res) {
+	STACK *s = ctxGet(ctx, level);
+	if(s == NULL || s->copy == 0)
+		return 0;
+
+	*copy = s->copy;
+	*res = ctxSet(ctx, level, s->next);
+	return 1;
+}
+
+// Merges the given level with the next one (leaving an argument)
+
+static CTX *ctxMerge(CTX *ctx, int level) {
+	STACK *first = ctxGet(ctx, level), *second = ctxGet(ctx, level+1);
+
+	ctx = ctxSet(ctxSet(ctx, level, NULL), level+1, NULL);
+	ctx = ctxShift(ctx, level+2, -1);
+	return first || second
+		? ctxSet(ctx, level, newStack(0, first, second, NULL))
+		: ctx;
+}
+
+// Splits the given level in two (entering an argument), stores the new
+// context in res. Returns 0 if the level does not contain a pair.
+
+static int ctxSplit(CTX *ctx, int level, CTX **res) {
+	STACK *s = ctxGet(ctx, level);
+	if(s != NULL && (s->copy != 0 || s->next != NULL))
+		return 0;
+
+	ctx = ctxShift(ctxSet(ctx, level, NULL), level+1, 1);
+	if(s != NULL)
+		ctx = ctxSet(ctxSet(ctx, level, s->first), level+1, s->second);
+	*res = ctx;
+	return 1;
+}
+
+// Translation of terms to nets
+//
+// Each node gets the level of the part of the term it is in: the number of
+// enclosing arguments, plus the level of the whole term. The variable of an
+// abstraction is connected to its occurrences through a tree of fans, an
+// occurrence inside an argument first leaves the argument through a bracket
+// (of the application's level).
+
+static void addUse(int binder, PORT port) {
+	if(useNo == useCapacity) {
+		useCapacity = useCapacity ? 2*useCapacity : 100;
+		uses = realloc(uses, useCapacity * sizeof(*uses));
+		assert(uses);
+	}
+	uses[useNo].binder = binder;
+	uses[useNo].port = port;
+	useNo++;
+}
+
+static int compareUses(const void *a, const void *b) {
+	const USE *ua = a, *ub = b;
+	return ua->binder != ub->binder
+		? ua->binder - ub->binder
+		: (int)(ua->port - ub->port);
+}
+
+// Connects the n uses u[0..n-1] through fans, returns the port to connect
+// with the value they use.
+
+static PORT share(USE *u, int n, int level) {
+	PORT res = u[n-1].port;
+	for(int i = n-2; i >= 0; i--) {
+		int fan = newNode(N_FAN, level);
+		wire(PORT_OF(fan, 1), u[i].port);
+		wire(PORT_OF(fan, 2), res);
+		res = PORT_OF(fan, 0);
+	}
+	return res;
+}
+
+// Called after translating the argument of an application at the given
+// level, whose uses start at start. The uses of each variable are shared and
+// leave the argument through a bracket, becoming a single use.
+
+static void closeArgument(int start, int level) {
+	if(useNo == start)
+		return;
+	qsort(uses + start, useNo - start, sizeof(USE), compareUses);
+
+	int next = start;
+	for(int i = start, j; i < useNo; i = j) {
+		for(j = i+1; j < useNo && uses[j].binder == uses[i].binder; j++);
+
+		int bracket = newNode(N_BRACKET, level);
+		wire(PORT_OF(bracket, 1), share(uses + i, j - i, level + 1));
+		uses[next].binder = uses[i].binder;
+		uses[next].port = PORT_OF(bracket, 0);
+		next++;
+	}
+	useNo = next;
+}
+
+// Called after translating the body of the innermost abstraction, at the given
+// level. Its variable is connected to its uses, the uses of other variables
+// remain for the enclosing abstractions.
+
+static void closeFrame(int level) {
+	FRAME *f = &frames[--frameNo];
+	int lam = f->node;
+
+	// the uses of this abstraction come last
+	if(useNo > f->uses)
+		qsort(uses + f->uses, useNo - f->uses, sizeof(USE), compareUses);
+
+	int i;
+	for(i = useNo; i > f->uses && uses[i-1].binder == frameNo; i--);
+
+	if(i < useNo)
+		wire(PORT_OF(lam, 2), share(uses + i, useNo - i, level));
+	else
+		wire(PORT_OF(lam, 2), PORT_OF(newNode(N_ERA, 0), 0));
+	useNo = i;
+}
+
+// translate
+//
+// Translates t at the given level, its value is sent to port to.
+// Variables bound outside t refer to frames.
+
+static void translate(TERM *t, PORT to, int level) {
+	int n, start;
+
+	switch(t->type) {
+	 case TM_VAR:
+		if(t->index >= 0) {
+			n = newNode(N_CROISSANT, level);
+			wire(PORT_OF(n, 1), to);
+			addUse(frameNo - 1 - t->index, PORT_OF(n, 0));
+			return;
+		}
+		n = newNode(N_VAR, 0);
+		nodes[n].name = NAME(t);
+		wire(PORT_OF(n, 0), to);
+		return;
+
+	 case TM_ALIAS:
+		n = newNode(N_ALIAS, level);
+		nodes[n].name = NAME(t);
+		wire(PORT_OF(n, 0), to);
+		return;
+
+	 case TM_APPL:
+		// operator ~ has no effect, the result is the same for all evaluation orders,
+		// but it is kept for the readback
+		n = newNode(N_APP, level);
+		nodes[n].name = NAME(t);
+		wire(PORT_OF(n, 2), to);
+		translate(LTERM(t), PORT_OF(n, 0), level);
+
+		start = useNo;
+		translate(RTERM(t), PORT_OF(n, 1), level + 1);
+		closeArgument(start, level);
+		return;
+
+	 case TM_ABSTR:
+		n = newNode(N_LAM, level);
+		nodes[n].name = NAME(t);
+		wire(PORT_OF(n, 0), to);
+
+		if(frameNo == frameCapacity) {
+			frameCapacity = frameCapacity ? 2*frameCapacity : 100;
+			frames = realloc(frames, frameCapacity * sizeof(*frames));
+			assert(frames);
+		}
+		frames[frameNo].node = n;
+		frames[frameNo].uses = useNo;
+		frameNo++;
+
+		translate(RTERM(t), PORT_OF(n, 1), level);
+		closeFrame(level);
+		return;
+
+	 case TM_SUBST:			// only with STRAT_EXPLICIT
+		assert(0);
+	}
+}
+
+// Replaces alias node n with the net of its declaration (declarations are closed)
+
+static int expandAlias(int n) {
+	TERM *t = getLiftedTerm(nodes[n].name);
+	if(t == NULL) {
+		printf("Error: Alias %s is not declared.\n", nodes[n].name);
+		error = 1;
+		return 0;
+	}
+
+	PORT to = peer(PORT_OF(n, 0));
+	int level = nodes[n].level;
+	freeNode(n);
+	translate(t, to, level);
+	return 1;
+}
+
+// Interaction rules
+
+static void pushEraser(int n) {
+	if(eraserNo == eraserCapacity) {
+		eraserCapacity = eraserCapacity ? 2*eraserCapacity : 100;
+		erasers = realloc(erasers, eraserCapacity * sizeof(*erasers));
+		assert(erasers);
+	}
+	erasers[eraserNo++] = n;
+}
+
+// Like wire, but remembers a and b if they are erasers, to be checked by erase
+
+static void connect(PORT a, PORT b) {
+	wire(a, b);
+	if(nodes[NODE_OF(a)].type == N_ERA)
+		pushEraser(NODE_OF(a));
+	if(nodes[NODE_OF(b)].type == N_ERA)
+		pushEraser(NODE_OF(b));
+}
+
+// erase
+//
+// Called at the end of each rule. whnf only rewrites the active pairs on the
+// path from the root, so the parts of the net that are discarded (the
+// arguments of abstractions that do not use their variable, and the copies
+// made for them) are never reached. They are deleted here instead: an eraser
+// facing the principal port of a node deletes it, the nodes whose principal
+// port faces an auxiliary port of that node are deleted in the same way and
+// the others get an eraser in place of the node. Two erasers facing each
+// other (or a free variable or an alias) simply disappear.
+
+static void erase() {
+	while(eraserNo > 0) {
+		// the eraser may be gone, or face an auxiliary port
+		int e = erasers[--eraserNo];
+		if(nodes[e].type != N_ERA)
+			continue;
+		PORT p = peer(PORT_OF(e, 0));
+		if(!isPrincipal(p))
+			continue;
+		freeNode(e);
+
+		// the nodes to delete are kept in the list of erasers, as negative numbers
+		pushEraser(~NODE_OF(p));
+		while(eraserNo > 0 && erasers[eraserNo-1] < 0) {
+			int n = ~erasers[--eraserNo];
+			for(int s = 1; s <= auxPorts[(int)nodes[n].type]; s++) {
+				PORT q = peer(PORT_OF(n, s));
+				if(NODE_OF(q) == n)
+					continue;
+				if(isPrincipal(q))
+					pushEraser(~NODE_OF(q));
+				else
+					wire(q, PORT_OF(newNode(N_ERA, 0), 0));
+			}
+			freeNode(n);
+		}
+	}
+}
+
+// Nodes a and b annihilate, port pa[i] of a is connected with port pb[i] of b.
+// The wires are followed in case a and b are connected to each other.
+
+static void annihilate(int a, int b, int n, const int *pa, const int *pb) {
+	for(int i = 0; i < n; i++) {
+		PORT p = peer(PORT_OF(a, pa[i]));
+		if(p != PORT_OF(b, pb[i]))
+			connect(p, peer(PORT_OF(b, pb[i])));
+	}
+	freeNode(a);
+	freeNode(b);
+	erase();
+}
+
+// beta-reduction, the body goes to the result and the argument to the variable
+
+static void beta(int lam, int app) {
+	static const int lamPorts[] = { 1, 2 }, appPorts[] = { 2, 1 };
+	annihilate(lam, app, 2, lamPorts, appPorts);
+	reductions++;
+}
+
+// Node a passes through node b, which faces it with port sb: a copy of a is
+// placed on each other port of b, and a copy of b on each auxiliary port of a.
+// The copies get levels la and lb. Returns the copy of a placed on the first
+// port of b.
+
+static int commute(int a, int la, int b, int sb, int lb) {
+	int na = auxPorts[(int)nodes[a].type];
+	int ca[2], cb[2], nb = 0;
+	int slots[2];
+
+	for(int s = 0; s <= auxPorts[(int)nodes[b].type]; s++)
+		if(s != sb)
+			slots[nb++] = s;
+
+	for(int i = 0; i < nb; i++) {
+		ca[i] = newNode(nodes[a].type, la);
+		nodes[ca[i]].name = nodes[a].name;
+	}
+	for(int j = 0; j < na; j++) {
+		cb[j] = newNode(nodes[b].type, lb);
+		nodes[cb[j]].name = nodes[b].name;
+	}
+
+	for(int i = 0; i < nb; i++)
+		connect(PORT_OF(ca[i], 0), peer(PORT_OF(b, slots[i])));
+	for(int j = 0; j < na; j++)
+		connect(PORT_OF(cb[j], sb), peer(PORT_OF(a, j+1)));
+	for(int i = 0; i < nb; i++)
+		for(int j = 0; j < na; j++)
+			wire(PORT_OF(ca[i], j+1), PORT_OF(cb[j], slots[i]));
+
+	freeNode(a);
+	freeNode(b);
+	erase();
+	return ca[0];
+}
+
+// Control node c lets node n (facing it with port sn) pass. The level of n
+// changes if it is higher than the level of c. Returns the copy of c placed
+// on the first port of n.
+
+static int pass(int c, int n, int sn) {
+	int level = nodes[n].level;
+	if(level > nodes[c].level)
+		level += levelChange[(int)nodes[c].type];
+	return commute(c, nodes[c].level, n, sn, level);
+}
+
+// interact
+//
+// Rewrites the active pair a, b. Returns 0 if there is no rule for it (eg. a
+// free variable applied to some argument).
+
+static int interact(int a, int b) {
+	static const int auxiliary[] = { 1, 2 };
+
+	if(nodes[a].type > nodes[b].type) {
+		int tmp = a;
+		a = b;
+		b = tmp;
+	}
+	NODE_TYPE ta = nodes[a].type, tb = nodes[b].type;
+
+	if(ta == N_LAM && tb == N_APP) {
+		beta(a, b);
+		return 1;
+	}
+
+	if(IS_CONTROL(tb) && !IS_CONTROL(ta) && ta != N_ROOT) {
+		// abstraction or application meeting a control node
+		pass(b, a, 0);
+		return 1;
+	}
+
+	if(!IS_CONTROL(ta))
+		return 0;
+
+	if(IS_CONTROL(tb)) {
+		// the control node of the lower level lets the other one pass
+		if(ta == tb && nodes[a].level == nodes[b].level)
+			annihilate(a, b, auxPorts[ta], auxiliary, auxiliary);
+		else if(nodes[a].level <= nodes[b].level)
+			pass(a, b, 0);
+		else
+			pass(b, a, 0);
+		return 1;
+	}
+
+	if(tb == N_VAR) {
+		// free variables are copied by fans, other control nodes disappear
+		if(ta == N_FAN) {
+			int var = newNode(N_VAR, 0);
+			nodes[var].name = nodes[b].name;
+			connect(PORT_OF(var, 0), peer(PORT_OF(a, 2)));
+		}
+		connect(PORT_OF(b, 0), peer(PORT_OF(a, 1)));
+		freeNode(a);
+		erase();
+		return 1;
+	}
+
+	return 0;
+}
+
+// Error found while following a path: the net cannot be read back
+
+static PORT corrupted() {
+	printf("Error: corrupted interaction net.\n");
+	error = 1;
+	return 0;
+}
+
+static inline void pushStep(PORT host, CTX *ctx) {
+	if(stepNo == stepCapacity) {
+		stepCapacity = stepCapacity ? 2*stepCapacity : 1000;
+		steps = realloc(steps, stepCapacity * sizeof(*steps));
+		assert(steps);
+	}
+	steps[stepNo].host = host;
+	steps[stepNo].ctx = ctx;
+	stepNo++;
+}
+
+// Called by whnf when the node connected to host is in head normal form. If
+// the path went through some applications, the first one is the head. If
+// control nodes face its result (it is shared, or moves to another level)
+// they are moved after it, so that each copy is read back separately. In
+// this case the path continues from (host, ctx), and 1 is returned.
+
+static int headFound(PORT *host, CTX **ctx) {
+	int k;
+	for(k = 0; k < stepNo && nodes[NODE_OF(peer(steps[k].host))].type != N_APP; k++);
+	if(k == stepNo)
+		return 0;
+
+	// k > 0, since the first host is not a control node
+	int i;
+	for(i = k; isPrincipal(steps[i].host) && IS_CONTROL(nodes[NODE_OF(steps[i].host)].type); i--) {
+		// all applications on the path are neutral, so the control node can go
+		// down the spine as long as it meets results of applications
+		int c = NODE_OF(steps[i].host);
+		PORT p;
+		do {
+			c = pass(c, NODE_OF(peer(PORT_OF(c, 0))), 2);
+			p = peer(PORT_OF(c, 0));
+		} while(nodes[NODE_OF(p)].type == N_APP && SLOT_OF(p) == 2);
+	}
+
+	*host = steps[i].host;
+	if(i == k)
+		return 0;
+
+	stepNo = i;
+	*ctx = steps[stepNo].ctx;
+	return 1;
+}
+
+// whnf
+//
+// Reduces the net until the node connected to port host (an input port) is in
+// head normal form: an abstraction, a variable, or an application whose function
+// is in head normal form (but not an abstraction). Returns the port of that node
+// which is connected to host, 0 in case of error.
+//
+// We follow the principal ports, starting from host. When two principal ports
+// meet, the active pair is rewritten and we go back one step. Control nodes
+// met from their principal port are left by the auxiliary port indicated by
+// the context.
+
+static PORT whnf(PORT host) {
+	CTX *ctx = NULL;
+	stepNo = 0;
+	block = blocks;
+	if(block)
+		block->used = 0;
+
+	while(1) {
+		PORT p = peer(host);
+		int n = NODE_OF(p), s = SLOT_OF(p), level = nodes[n].level;
+		NODE_TYPE type = nodes[n].type;
+
+		if(type == N_ALIAS) {
+			if(!expandAlias(n))
+				return 0;
+
+		} else if(s == 0) {
+			// the principal port of n faces host, if host is also principal we have an active pair
+			if(isPrincipal(host) && interact(NODE_OF(host), n)) {
+				// the node of host is gone, we go back one step
+				if(stepNo == 0)
+					return corrupted();
+				stepNo--;
+				host = steps[stepNo].host;
+				ctx = steps[stepNo].ctx;
+
+				if((reductions & 1023) == 0 && trace) {
+					// SIGINT enables trace, which is not supported here
+					printf("Interrupted.\n");
+					error = 1;
+					return 0;
+				}
+
+			} else if(IS_CONTROL(type)) {
+				// the context chooses the auxiliary port
+				int copy = 1;
+				pushStep(host, ctx);
+				if(type == N_FAN ? !ctxPop(ctx, level, &copy, &ctx) :
+					type == N_BRACKET ? !ctxSplit(ctx, level, &ctx) :
+					ctxGet(ctx, level) != NULL)
+					return corrupted();
+				if(type == N_CROISSANT)
+					ctx = ctxShift(ctx, level+1, -1);
+				host = PORT_OF(n, copy);
+
+			} else if(!headFound(&host, &ctx)) {
+				return peer(host);
+			}
+
+		} else if(type == N_LAM) {
+			// a variable, if its abstraction is being copied we need to know which copy it belongs to
+			PORT q = peer(PORT_OF(n, 0));
+			if(!(isPrincipal(q) && interact(NODE_OF(q), n)) && !headFound(&host, &ctx))
+				return peer(host);
+
+		} else {
+			// we need the node connected to the principal port of n
+			pushStep(host, ctx);
+			if(type == N_FAN)
+				ctx = ctxSet(ctx, level, newStack(s, NULL, NULL, ctxGet(ctx, level)));
+			else if(type == N_BRACKET)
+				ctx = ctxMerge(ctx, level);
+			else if(type == N_CROISSANT)
+				ctx = ctxShift(ctx, level, 1);
+			host = PORT_OF(n, 0);
+		}
+
+		if(error)
+			return 0;
+	}
+}
+
+// readback
+//
+// Returns the normal form of the term whose value is connected to host, as a
+// new term (NULL in case of error). Abstractions are read back only once (a
+// shared one is a redex, which is copied before we reach it), so their nodes
+// keep the name of their variable.
+
+static TERM *readback(PORT host) {
+	PORT p = whnf(host);
+	if(p == 0)
+		return NULL;
+
+	int n = NODE_OF(p);
+	switch(nodes[n].type) {
+	 case N_VAR:
+		return readbackTerm(TM_VAR, nodes[n].name, NULL, NULL);
+
+	 case N_APP: {
+		TERM *lterm = NULL, *rterm = NULL;
+		if(readbackNest(&error)) {
+			lterm = readback(PORT_OF(n, 0));
+			rterm = lterm ? readback(PORT_OF(n, 1)) : NULL;
+		}
+		readbackUnnest();
+		if(rterm == NULL) {
+			termFree(lterm);
+			return NULL;
+		}
+		return readbackTerm(TM_APPL, nodes[n].name, lterm, rterm);
+	 }
+
+	 case N_LAM:
+		break;
+
+	 default:
+		corrupted();
+		return NULL;
+	}
+
+	if(SLOT_OF(p) == 2) {
+		// variable, its abstraction must be the one being read back
+		if(nodes[n].uses < 0) {
+			corrupted();
+			return NULL;
+		}
+		nodes[n].uses++;
+		return readbackTerm(TM_VAR, nodes[n].name, NULL, NULL);
+	}
+
+	// keep the name of the abstraction, unless it would capture some other variable
+	char *name = readbackBind(nodes[n].name);
+	nodes[n].name = name;
+	nodes[n].uses = 0;
+
+	TERM *body = readbackNest(&error) ? readback(PORT_OF(n, 1)) : NULL;
+	readbackUnnest();
+	readbackUnbind(name);
+
+	if(body == NULL)
+		return NULL;
+
+	// eta-conversion: \x.M x -> M  if x not free in M
+	if(body->type == TM_APPL &&
+		RTERM(body)->type == TM_VAR &&
+		NAME(RTERM(body)) == name &&
+		nodes[n].uses == 1) {
+
+		TERM *M = LTERM(body);
+		SET_LTERM(body, NULL);
+		termFree(body);
+		reductions++;
+		return M;
+	}
+
+	return readbackTerm(TM_ABSTR, name, NULL, body);
+}
+
+static void inetFreeAll() {
+	free(nodes);
+	nodes = NULL;
+	nodeNo = nodeCapacity = 0;
+	freeNodes = -1;
+
+	free(steps);
+	steps = NULL;
+	stepNo = stepCapacity = 0;
+
+	free(uses);
+	uses = NULL;
+	useNo = useCapacity = 0;
+
+	free(frames);
+	frames = NULL;
+	frameNo = frameCapacity = 0;
+
+	free(erasers);
+	erasers = NULL;
+	eraserNo = eraserCapacity = 0;
+
+	while(blocks) {
+		BLOCK *next = blocks->next;
+		free(blocks);
+		blocks = next;
+	}
+	block = NULL;
+}
+
+// inetNormalize
+//
+// Computes the normal form of t using optimal reduction, t is replaced by its
+// normal form. The number of beta-reductions is stored in redno.
+//
+// Returns
+// 	0	If the normal form was computed
+// 	-1	If some error happened
+
+int inetNormalize(TERM *t, uint64_t *redno) {
+	error = 0;
+	reductions = readbackInit(t);
+
+	int root = newNode(N_ROOT, 0);
+	translate(t, PORT_OF(root, 0), 0);
+
+	TERM *res = readback(PORT_OF(root, 0));
+	readbackFinish(t, res);
+
+	*redno = reductions;
+	inetFreeAll();
+
+	return error ? -1 : 0;
+}
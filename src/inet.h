@@ -0,0 +1,11 @@
+// Declarations for inet.c
+// Copyright Kostas Chatzikokolakis
+
+#pragma once
+
+#include <stdint.h>
+
+#include "parser.h"
+
+
+int inetNormalize(TERM *t, uint64_t *redno);
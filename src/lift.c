@@ -0,0 +1,196 @@
+// vim:noet:ts=3
+
+// Lifting of closed subterms out of abstractions
+// Copyright Kostas Chatzikokolakis
+//
+// When an alias is substituted its whole body is cloned, including closed
+// subterms inside abstractions (for example Succ (Succ 0) in \n.Mult n 2),
+// which are then cloned and reduced again every time the abstraction is
+// applied. So, before a declaration is used, every maximal closed subterm
+// (application or abstraction) which lies under some abstraction is moved
+// to a new internal alias Id#n and replaced by it (full laziness). '#' starts
+// a comment, so these ids cannot clash with the ones of the program.
+//
+// The body of a new alias is also replaced by its normal form, when this can
+// be found within LIFT_REDUCTIONS reductions (closed terms need not have one,
+// eg. Y f). These reductions are done once, not in every call, and are not
+// included in the count of execTerm. Then the normal form itself is lifted, it
+// might contain abstractions with closed subterms.
+//
+// Subterms with free variables are not lifted, in this interpreter abstracting
+// over their variables would cost an extra beta-reduction in every call.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "lift.h"
+#include "termproc.h"
+#include "decllist.h"
+#include "run.h"
+#include "str_intern.h"
+
+
+#define LIFT_REDUCTIONS	100			// max reductions when normalizing the body of a new alias
+#define LIFT_SIZE			10000		// max size (in nodes) of the body while normalizing
+
+
+static char *liftId;						// the declaration being lifted
+static int liftNo;						// number of aliases created for it
+static SymTab *liftAliases;				// where the new aliases are stored
+
+static void liftTerm(TERM *t, int depth);
+
+
+// Returns the number of nodes of t, or some number > max if it is larger than max
+
+static int termSize(TERM *t, int max) {
+	int size = 1;
+
+	if(t->type == TM_APPL)
+		size += termSize(LTERM(t), max);
+	if(size <= max && (t->type == TM_APPL || t->type == TM_ABSTR))
+		size += termSize(RTERM(t), max - size);
+
+	return size;
+}
+
+// Returns 1 if all aliases used by t (and by their declarations) are declared.
+// 'seen' contains the aliases already checked.
+
+static int aliasesDeclared(TERM *t, SymTab *seen) {
+	switch(t->type) {
+	 case TM_VAR:
+		return 1;
+
+	 case TM_ALIAS: {
+		if(symtab_find(seen, NAME(t)) != NULL)
+			return 1;
+		symtab_insert(seen, NAME(t), NAME(t));
+
+		TERM *decl = getDeclarationTerm(NAME(t));
+		return decl != NULL && aliasesDeclared(decl, seen);
+	 }
+
+	 case TM_ABSTR:
+		return aliasesDeclared(RTERM(t), seen);
+
+	 case TM_APPL:
+		return aliasesDeclared(LTERM(t), seen) && aliasesDeclared(RTERM(t), seen);
+
+	 case TM_SUBST:			// closures only exist during execution
+		assert(0);
+	}
+	return 0;
+}
+
+// liftNormalize
+//
+// Replaces the closed term t by its normal form (under normal order), if it is
+// found within the limits. Terms using undefined aliases are left unchanged,
+// they might be declared later (and we should not print errors here).
+
+static void liftNormalize(TERM *t) {
+	SymTab *seen = symtab_create(NULL);
+	int declared = aliasesDeclared(t, seen);
+	symtab_destroy(seen);
+
+	if(!declared)
+		return;
+
+	int strategy = getOption(OPT_STRATEGY);
+	setOption(OPT_STRATEGY, STRAT_NORMAL);
+
+	TERM *nf = termClone(t);
+	termConvReset();
+	int res = 1;
+	for(int i = 0; res > 0 && i <= LIFT_REDUCTIONS && termSize(nf, LIFT_SIZE) <= LIFT_SIZE; i += res)
+		res = termConv(nf);
+
+	setOption(OPT_STRATEGY, strategy);
+
+	if(res != 0) {
+		termFree(nf);
+		return;
+	}
+
+	// nf might contain shared terms of other declarations (see termFreeze), so
+	// a clone of it is moved to t, and t's old subterms are freed
+	TERM *clone = termClone(nf);
+	termFree(nf);
+
+	TERM *old = termNew();
+	*old = *t;
+	*t = *clone;
+	SET_LTERM(clone, NULL); SET_RTERM(clone, NULL);
+	termFree(clone);
+	termFree(old);
+}
+
+// liftSubterm
+//
+// Moves the closed term t to a new alias, and makes t an occurrence of it
+
+static void liftSubterm(TERM *t) {
+	char *name = malloc(strlen(liftId) + 20);
+	assert(name);
+	sprintf(name, "%s#%d", liftId, ++liftNo);
+	char *id = str_intern(name);
+	free(name);
+
+	TERM *body = termNew();
+	*body = *t;
+
+	t->type = TM_ALIAS;
+	SET_NAME(t, id);
+	t->index = VAR_FREE;
+	FREE_MASK(t) = 0;
+	t->closed = 1;
+	SET_LTERM(t, NULL); SET_RTERM(t, NULL);
+
+	liftNormalize(body);
+	liftTerm(body, 0);
+	symtab_insert(liftAliases, id, body);
+}
+
+// liftTerm
+//
+// Lifts the maximal closed subterms of t which are inside some abstraction
+// (depth is the number of abstractions above t)
+
+static void liftTerm(TERM *t, int depth) {
+	t->normal = 0;			// (see parser.h) a subterm might become an alias
+
+	if(depth > 0 && t->closed && (t->type == TM_APPL || t->type == TM_ABSTR)) {
+		liftSubterm(t);
+		return;
+	}
+
+	switch(t->type) {
+	 case TM_ABSTR:
+		liftTerm(RTERM(t), depth + 1);
+		return;
+
+	 case TM_APPL:
+		liftTerm(LTERM(t), depth);
+		liftTerm(RTERM(t), depth);
+		return;
+
+	 default:
+		return;
+	}
+}
+
+// termLift
+//
+// Lifts the closed subterms of t, the body of declaration id (modified in
+// place). The new aliases are added in 'aliases' (id => TERM).
+
+void termLift(char *id, TERM *t, SymTab *aliases) {
+	liftId = id;
+	liftNo = 0;
+	liftAliases = aliases;
+
+	liftTerm(t, 0);
+}
@@ -0,0 +1,10 @@
+// Declarations for lift.c
+// Copyright Kostas Chatzikokolakis
+
+#pragma once
+
+#include "symtab.h"
+#include "parser.h"
+
+
+void termLift(char *id, TERM *t, SymTab *aliases);
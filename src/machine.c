@@ -0,0 +1,744 @@
+// vim:noet:ts=3
+
+// Call-by-name and call-by-need evaluation using an environment machine
+// Copyright Kostas Chatzikokolakis
+//
+// termConv reduces terms by rewriting the tree, so each beta-reduction costs
+// time proportional to the size of the body. Here, instead, arguments are never
+// substituted: an application creates a heap cell holding the argument together
+// with its environment, and all occurrences of the variable share this cell, so
+// a beta-reduction just extends the environment.
+//
+// In call-by-name mode (Krivine machine) a cell is evaluated each time its
+// value is needed, performing the same beta-reductions as normal order. In
+// call-by-need mode the cell is overwritten with its value the first time it
+// is evaluated, so the work is done only once.
+//
+// The machine does not run on the tree of the term, but on its compiled code
+// (see bytecode.c), in which the spine of each term is a sequence of GRAB
+// and PUSH instructions. Declarations are compiled once and their code is
+// reused by all evaluations.
+//
+// The machine computes weak head normal forms. The full normal form (which is
+// what lci prints) is obtained by "reading back" the value: the body of an
+// abstraction is evaluated with its variable bound to a neutral term, and the
+// arguments of neutral terms are read back recursively.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "ADTMap.h"
+
+#include "machine.h"
+#include "termproc.h"
+#include "decllist.h"
+#include "run.h"
+#include "bytecode.h"
+#include "str_intern.h"
+
+
+typedef struct cell CELL;
+typedef struct env ENV;
+typedef struct value VALUE;
+typedef struct variable VARIABLE;
+typedef struct arg ARG;
+
+// All objects of the machine start with a common header, used by the garbage collector
+typedef enum { OBJ_FREE, OBJ_CELL, OBJ_ENV, OBJ_VALUE, OBJ_VARIABLE, OBJ_ARG } OBJ_TYPE;
+
+typedef struct {
+	char type;					// OBJ_TYPE
+	char mark;					// set during the mark phase if the object is reachable
+} HEADER;
+
+// A (possibly suspended) argument. Once forced, value is set and
+// all terms sharing the cell see the result.
+struct cell {
+	HEADER h;
+	INSTR *pc;					// code of the suspended computation
+	ENV *env;					// and its environment
+	VALUE *value;				// value of the cell, NULL if not forced yet
+	char busy;					// 1 while the cell is being forced
+};
+
+// Cells of the variables bound by the enclosing abstractions, the variable
+// with de Bruijn index i is bound to the i-th cell of the list.
+struct env {
+	HEADER h;
+	CELL *cell;
+	ENV *next;
+};
+
+// A free variable, either of the original term or introduced
+// when reading back the body of an abstraction.
+struct variable {
+	HEADER h;
+	char *name;
+	int uses;					// number of occurrences in the read-back term
+};
+
+// arguments of a neutral term, most recent first
+struct arg {
+	HEADER h;
+	CELL *cell;
+	ARG *next;
+	char strict;				// 1 if applied with operator ~
+};
+
+typedef enum { VAL_CLOSURE, VAL_NEUTRAL } VALUE_TYPE;
+
+// A value in weak head normal form, either an abstraction with its
+// environment or a variable applied to some arguments.
+struct value {
+	HEADER h;
+	VALUE_TYPE type;
+	INSTR *pc;					// closure: code of the abstraction (a GRAB)
+	ENV *env;					//          and its environment
+	VARIABLE *var;				// neutral: head variable
+	ARG *args;					//          and its arguments
+};
+
+// Frames of the machine's stack
+typedef enum { FR_ARG, FR_UPDATE, FR_STRICT } FRAME_TYPE;
+
+typedef struct {
+	FRAME_TYPE type;
+	CELL *cell;					// ARG: the argument, UPDATE: the cell to update, STRICT: the argument being forced
+	INSTR *pc;					// STRICT: the code to continue with after forcing the cell
+	ENV *env;
+	char strict;				// ARG: 1 if pushed by a STRICT, kept for the readback of neutral terms
+} FRAME;
+
+// Objects are allocated in chunks, unused ones are kept in a free list
+typedef struct free_obj {
+	HEADER h;
+	struct free_obj *next;
+} FREE_OBJ;
+
+typedef union {
+	HEADER h;
+	CELL cell;
+	ENV env;
+	VALUE value;
+	VARIABLE var;
+	ARG arg;
+	FREE_OBJ free;
+} OBJECT;
+
+#define CHUNK_OBJECTS	(1 << 15)
+#define GC_MIN			(1 << 20)		// never collect before allocating that many objects
+
+typedef struct chunk {
+	struct chunk *next;
+	OBJECT objects[CHUNK_OBJECTS];
+} CHUNK;
+
+static CHUNK *chunks = NULL;
+static FREE_OBJ *freeList = NULL;
+static int allocated = 0, gcThreshold = GC_MIN;
+
+// values held by readback while the machine runs, they must survive garbage collection
+static void **roots = NULL;
+static int rootNo = 0, rootCapacity = 0;
+
+static FRAME *frames = NULL;
+static int frameNo = 0, frameCapacity = 0;
+
+static Map aliasCells = NULL;		// alias => CELL, aliases are shared during an evaluation
+static Map freeCells = NULL;		// name => CELL holding the corresponding free variable
+static Map undeclared = NULL;		// alias => code entering it, for undeclared aliases used as arguments
+
+static uint64_t reductions;
+static int error;
+static int lazy;					// 1 for call-by-need, 0 for call-by-name
+
+
+static VALUE *eval(INSTR *pc, ENV *env);
+static VALUE *force(CELL *cell);
+static TERM *readback(VALUE *v);
+
+
+static int compare_pointers(Pointer a, Pointer b) {
+	return a - b;
+}
+
+static void *machineAlloc(OBJ_TYPE type) {
+	if(freeList == NULL) {
+		CHUNK *chunk = malloc(sizeof(CHUNK));
+		assert(chunk);
+		chunk->next = chunks;
+		chunks = chunk;
+
+		for(int i = CHUNK_OBJECTS-1; i >= 0; i--) {
+			FREE_OBJ *obj = &chunk->objects[i].free;
+			obj->h.type = OBJ_FREE;
+			obj->next = freeList;
+			freeList = obj;
+		}
+	}
+
+	OBJECT *obj = (OBJECT *)freeList;
+	freeList = freeList->next;
+	obj->h.type = type;
+	obj->h.mark = 0;
+	allocated++;
+	return obj;
+}
+
+static void pushRoot(void *obj) {
+	if(rootNo == rootCapacity) {
+		rootCapacity = rootCapacity ? 2*rootCapacity : 100;
+		roots = realloc(roots, rootCapacity * sizeof(*roots));
+		assert(roots);
+	}
+	roots[rootNo++] = obj;
+}
+
+static void popRoot() {
+	assert(rootNo > 0);
+	rootNo--;
+}
+
+static void machineFreeAll() {
+	while(chunks) {
+		CHUNK *next = chunks->next;
+		free(chunks);
+		chunks = next;
+	}
+	freeList = NULL;
+	allocated = 0;
+	gcThreshold = GC_MIN;
+
+	free(frames);
+	frames = NULL;
+	frameNo = frameCapacity = 0;
+
+	free(roots);
+	roots = NULL;
+	rootNo = rootCapacity = 0;
+
+	map_destroy(aliasCells);
+	map_destroy(freeCells);
+	map_destroy(undeclared);
+	aliasCells = freeCells = undeclared = NULL;
+}
+
+// Garbage collection
+//
+// Marks all objects reachable from the frames of the stack, the roots
+// held by readback, the shared cells of aliases and free variables and
+// the current environment. Unreachable objects are moved to the free list.
+// Note: uses an explicit stack, environments can be very long.
+
+static OBJECT **markStack = NULL;
+static int markNo = 0, markCapacity = 0;
+
+static inline void mark(void *p) {
+	OBJECT *obj = p;
+	if(obj == NULL || obj->h.mark)
+		return;
+
+	obj->h.mark = 1;
+	if(markNo == markCapacity) {
+		markCapacity = markCapacity ? 2*markCapacity : 1000;
+		markStack = realloc(markStack, markCapacity * sizeof(*markStack));
+		assert(markStack);
+	}
+	markStack[markNo++] = obj;
+}
+
+static void collect(ENV *env) {
+	mark(env);
+	for(int i = 0; i < frameNo; i++) {
+		mark(frames[i].cell);
+		mark(frames[i].env);
+	}
+	for(int i = 0; i < rootNo; i++)
+		mark(roots[i]);
+	for(MapNode node = map_first(aliasCells); node != MAP_EOF; node = map_next(aliasCells, node))
+		mark(map_node_value(aliasCells, node));
+	for(MapNode node = map_first(freeCells); node != MAP_EOF; node = map_next(freeCells, node))
+		mark(map_node_value(freeCells, node));
+
+	while(markNo > 0) {
+		OBJECT *obj = markStack[--markNo];
+
+		switch(obj->h.type) {
+		 case OBJ_CELL:
+			mark(obj->cell.env);
+			mark(obj->cell.value);
+			break;
+		 case OBJ_ENV:
+			mark(obj->env.cell);
+			mark(obj->env.next);
+			break;
+		 case OBJ_VALUE:
+			mark(obj->value.env);
+			mark(obj->value.var);
+			mark(obj->value.args);
+			break;
+		 case OBJ_ARG:
+			mark(obj->arg.cell);
+			mark(obj->arg.next);
+			break;
+		}
+	}
+
+	// sweep
+	allocated = 0;
+	freeList = NULL;
+	for(CHUNK *chunk = chunks; chunk != NULL; chunk = chunk->next) {
+		for(int i = 0; i < CHUNK_OBJECTS; i++) {
+			OBJECT *obj = &chunk->objects[i];
+			if(obj->h.mark) {
+				obj->h.mark = 0;
+				allocated++;
+			} else {
+				obj->h.type = OBJ_FREE;
+				obj->free.next = freeList;
+				freeList = &obj->free;
+			}
+		}
+	}
+
+	free(markStack);
+	markStack = NULL;
+	markNo = markCapacity = 0;
+
+	// next collection when the live objects are doubled
+	gcThreshold = 2*allocated > GC_MIN ? 2*allocated : GC_MIN;
+}
+
+static inline void pushFrame(FRAME_TYPE type, CELL *cell, INSTR *pc, ENV *env) {
+	if(frameNo == frameCapacity) {
+		frameCapacity = frameCapacity ? 2*frameCapacity : 1000;
+		frames = realloc(frames, frameCapacity * sizeof(*frames));
+		assert(frames);
+	}
+
+	FRAME *f = &frames[frameNo++];
+	f->type = type;
+	f->cell = cell;
+	f->pc = pc;
+	f->env = env;
+	f->strict = 0;
+}
+
+static CELL *newCell(INSTR *pc, ENV *env, VALUE *value) {
+	CELL *cell = machineAlloc(OBJ_CELL);
+	cell->pc = pc;
+	cell->env = env;
+	cell->value = value;
+	cell->busy = 0;
+	return cell;
+}
+
+static ENV *extend(ENV *env, CELL *cell) {
+	ENV *res = machineAlloc(OBJ_ENV);
+	res->cell = cell;
+	res->next = env;
+	return res;
+}
+
+static VALUE *newClosure(INSTR *pc, ENV *env) {
+	VALUE *v = machineAlloc(OBJ_VALUE);
+	v->type = VAL_CLOSURE;
+	v->pc = pc;
+	v->env = env;
+	v->var = NULL;
+	v->args = NULL;
+	return v;
+}
+
+static VALUE *newNeutral(VARIABLE *var, ARG *args) {
+	VALUE *v = machineAlloc(OBJ_VALUE);
+	v->type = VAL_NEUTRAL;
+	v->pc = NULL;
+	v->env = NULL;
+	v->var = var;
+	v->args = args;
+	return v;
+}
+
+static VARIABLE *newVariable(char *name) {
+	VARIABLE *var = machineAlloc(OBJ_VARIABLE);
+	var->name = name;
+	var->uses = 0;
+	return var;
+}
+
+// Returns the cell of the variable with de Bruijn index i
+
+static inline CELL *envCell(ENV *env, int i) {
+	for(; i > 0; i--)
+		env = env->next;
+	return env->cell;
+}
+
+// Returns the cell of a free variable, all its occurrences share the same cell
+
+static CELL *freeCell(char *name) {
+	CELL *cell = map_find(freeCells, name);
+	if(cell == NULL) {
+		cell = newCell(NULL, NULL, newNeutral(newVariable(name), NULL));
+		map_insert(freeCells, name, cell);
+	}
+	return cell;
+}
+
+// Returns the cell of an alias. All occurrences of an alias share the same
+// cell, so closed terms like "Nats 1" are computed only once. Declarations are
+// closed, so their code is run in the empty environment.
+
+static CELL *aliasCell(char *name) {
+	CELL *cell = map_find(aliasCells, name);
+	if(cell == NULL) {
+		CODE *code = getDeclarationCode(name);
+		if(code == NULL) {
+			printf("Error: Alias %s is not declared.\n", name);
+			error = 1;
+			return NULL;
+		}
+
+		cell = newCell(code->code, NULL, NULL);
+		map_insert(aliasCells, name, cell);
+	}
+	return cell;
+}
+
+// Returns the cell of an alias used as an argument. As in normal order, an
+// undeclared alias is an error only if the argument is needed, so it gets a
+// new cell whose code enters the alias (and fails when the cell is forced).
+
+static CELL *argAliasCell(char *name) {
+	if(map_find(aliasCells, name) != NULL || getDeclarationCode(name) != NULL)
+		return aliasCell(name);
+
+	INSTR *code = map_find(undeclared, name);
+	if(code == NULL) {
+		code = malloc(2 * sizeof(INSTR));
+		assert(code);
+		code[0] = OP_ALIAS;
+		code[1] = (INSTR)name;
+		map_insert(undeclared, name, code);
+	}
+	return newCell(code, NULL, NULL);
+}
+
+// Returns the cell of the argument of PUSH* instruction pc in environment env.
+// Variables and aliases already have a cell which is shared, abstractions are
+// already values.
+
+static CELL *argCell(INSTR *pc, ENV *env) {
+	switch(pc[0]) {
+	 case OP_PUSHVAR:
+		return envCell(env, pc[1]);
+
+	 case OP_PUSHFREE:
+		return freeCell((char*)pc[1]);
+
+	 case OP_PUSHALIAS:
+		return argAliasCell((char*)pc[1]);
+
+	 case OP_PUSHFUN:
+		return newCell(pc + pc[1], env, newClosure(pc + pc[1], env));
+
+	 default:
+		return newCell(pc + pc[1], env, NULL);
+	}
+}
+
+// Forcing a cell which is already being forced means that its value depends
+// on itself (eg. Loop = Loop), so the evaluation would never terminate.
+
+static VALUE *loopError() {
+	printf("Error: infinite loop detected, a term depends on its own value.\n");
+	error = 1;
+	return NULL;
+}
+
+// SIGINT enables trace, which the machine cannot support, so the evaluation is aborted
+
+static VALUE *interrupted() {
+	printf("Interrupted.\n");
+	error = 1;
+	return NULL;
+}
+
+// run
+//
+// Runs the code at pc in environment env until a weak head normal form is found.
+// Returns NULL in case of error.
+
+static VALUE *run(INSTR *pc, ENV *env) {
+	int base = frameNo;			// frames below base belong to the caller
+	int strict = 0;				// set by STRICT for the next PUSH*
+	VALUE *v = NULL;
+
+	while(1) {
+		// safe point for garbage collection, the only live object not in the stack is env
+		if(allocated > gcThreshold)
+			collect(env);
+
+		// run the code at pc in env until a value v is found
+		if(pc[0] == OP_STRICT) {
+			strict = 1;
+			pc += 2;
+			continue;
+
+		} else if(pc[0] >= OP_PUSH) {
+			CELL *cell = argCell(pc, env);
+			if(!cell)
+				return NULL;
+
+			if(strict && !cell->value) {
+				// call-by-value: the argument is forced (to weak head normal form) before the application
+				pushFrame(FR_STRICT, cell, pc + 2, env);
+				if(lazy) {
+					if(cell->busy)
+						return loopError();
+					pushFrame(FR_UPDATE, cell, NULL, NULL);
+					cell->busy = 1;
+				}
+				pc = cell->pc;
+				env = cell->env;
+			} else {
+				pushFrame(FR_ARG, cell, NULL, NULL);
+				frames[frameNo-1].strict = strict;
+				pc += 2;
+			}
+			strict = 0;
+			continue;
+
+		} else if(pc[0] == OP_GRAB) {
+			if(frameNo > base && frames[frameNo-1].type == FR_ARG) {
+				// beta-reduction, just bind the variable in the environment
+				env = extend(env, frames[--frameNo].cell);
+				pc += 2;
+				if(++reductions % 1024 == 0 && trace)
+					return interrupted();
+				continue;
+			}
+			v = newClosure(pc, env);
+
+		} else {
+			// ACCESS, FREE or ALIAS
+			CELL *cell =
+				pc[0] == OP_ACCESS ? envCell(env, pc[1]) :
+				pc[0] == OP_FREE   ? freeCell((char*)pc[1]) :
+				aliasCell((char*)pc[1]);
+			if(!cell)
+				return NULL;
+
+			if(cell->value) {
+				v = cell->value;
+			} else {
+				// force the cell, in call-by-need the frame will update it with its value
+				if(lazy) {
+					if(cell->busy)
+						return loopError();
+					pushFrame(FR_UPDATE, cell, NULL, NULL);
+					cell->busy = 1;
+				}
+				pc = cell->pc;
+				env = cell->env;
+				continue;
+			}
+		}
+
+		// v is a value, return it to the frames of the stack. If some frame
+		// continues the evaluation then (pc, env) are set and we go on.
+		int resume = 0;
+		while(!resume && frameNo > base) {
+			FRAME *f = &frames[frameNo-1];
+
+			if(f->type == FR_UPDATE) {
+				f->cell->value = v;
+				f->cell->busy = 0;
+				frameNo--;
+
+			} else if(f->type == FR_STRICT) {
+				// the argument is forced, now apply the function to it. In call-by-name
+				// the value is passed in a new cell, the shared one is never updated.
+				pc = f->pc;
+				env = f->env;
+				f->type = FR_ARG;
+				f->strict = 1;
+				if(!lazy)
+					f->cell = newCell(NULL, NULL, v);
+				resume = 1;
+
+			} else if(v->type == VAL_CLOSURE) {
+				// beta-reduction, skip the GRAB of the closure
+				env = extend(v->env, f->cell);
+				pc = v->pc + 2;
+				frameNo--;
+				resume = 1;
+
+				if(++reductions % 1024 == 0 && trace)
+					return interrupted();
+
+			} else {
+				// neutral terms just collect their arguments
+				ARG *arg = machineAlloc(OBJ_ARG);
+				arg->cell = f->cell;
+				arg->next = v->args;
+				arg->strict = f->strict;
+				v = newNeutral(v->var, arg);
+				frameNo--;
+			}
+		}
+
+		if(!resume)
+			return v;
+	}
+}
+
+// eval
+//
+// Like run, but counts the nesting: run itself does not recurse, but readback
+// calls it for the body of every abstraction and (through force) for every
+// argument of a neutral term.
+
+static VALUE *eval(INSTR *pc, ENV *env) {
+	VALUE *v = readbackNest(&error) ? run(pc, env) : NULL;
+	readbackUnnest();
+	return v;
+}
+
+// force
+//
+// Returns the value of a cell, evaluating it if needed
+
+static VALUE *force(CELL *cell) {
+	if(cell->value != NULL)
+		return cell->value;
+
+	pushRoot(cell);
+	VALUE *v;
+	if(lazy) {
+		if(cell->busy) {
+			popRoot();
+			return loopError();
+		}
+
+		cell->busy = 1;
+		v = cell->value = eval(cell->pc, cell->env);
+		cell->busy = 0;
+	} else {
+		v = eval(cell->pc, cell->env);
+	}
+	popRoot();
+
+	return v;
+}
+
+// readbackNeutral
+//
+// Reads back a variable applied to args (most recent first)
+
+static TERM *readbackNeutral(VARIABLE *var, ARG *args) {
+	if(args == NULL) {
+		var->uses++;
+		return readbackTerm(TM_VAR, var->name, NULL, NULL);
+	}
+
+	TERM *lterm = readbackNest(&error) ? readbackNeutral(var, args->next) : NULL;
+	readbackUnnest();
+	VALUE *v = lterm ? force(args->cell) : NULL;
+	TERM *rterm = v ? readback(v) : NULL;
+
+	if(rterm == NULL) {
+		termFree(lterm);
+		return NULL;
+	}
+	return readbackTerm(TM_APPL, args->strict ? str_symbol(SYM_TILDE) : NULL, lterm, rterm);
+}
+
+// readback
+//
+// Returns the normal form of value v, as a new term. The body of a closure is
+// evaluated with its variable bound to a new neutral term. Eta-reductions are
+// performed here: in a beta-normal form they cannot create new redexes.
+
+static TERM *readback(VALUE *v) {
+	if(!readbackNest(&error)) {
+		readbackUnnest();
+		return NULL;
+	}
+
+	if(v->type == VAL_NEUTRAL) {
+		pushRoot(v);
+		TERM *res = readbackNeutral(v->var, v->args);
+		popRoot();
+		readbackUnnest();
+		return res;
+	}
+
+	// keep the name of the abstraction, unless it would capture some other variable
+	char *name = readbackBind((char*)v->pc[1]);
+
+	VARIABLE *var = newVariable(name);
+	CELL *cell = newCell(NULL, NULL, newNeutral(var, NULL));
+
+	pushRoot(var);
+	VALUE *bodyValue = eval(v->pc + 2, extend(v->env, cell));
+	TERM *body = bodyValue ? readback(bodyValue) : NULL;
+	readbackUnbind(name);
+	popRoot();
+	readbackUnnest();
+
+	if(body == NULL)
+		return NULL;
+
+	// eta-conversion: \x.M x -> M  if x not free in M
+	if(body->type == TM_APPL &&
+		RTERM(body)->type == TM_VAR &&
+		NAME(RTERM(body)) == name &&
+		var->uses == 1) {
+
+		TERM *M = LTERM(body);
+		SET_LTERM(body, NULL);
+		termFree(body);
+		reductions++;
+		return M;
+	}
+
+	return readbackTerm(TM_ABSTR, name, NULL, body);
+}
+
+// machineNormalize
+//
+// Computes the normal form of t using call-by-need (if lazy = 1) or call-by-name,
+// t is replaced by its normal form. The number of reductions is stored in redno.
+//
+// Returns
+// 	0	If the normal form was computed
+// 	-1	If some error happened
+
+int machineNormalize(TERM *t, int lazyEval, uint64_t *redno) {
+	aliasCells = map_create(compare_pointers, NULL, NULL);
+	freeCells = map_create(compare_pointers, NULL, NULL);
+	undeclared = map_create(compare_pointers, NULL, free);
+	map_set_hash_function(aliasCells, hash_pointer);
+	map_set_hash_function(freeCells, hash_pointer);
+	map_set_hash_function(undeclared, hash_pointer);
+
+	error = 0;
+	lazy = lazyEval;
+	reductions = readbackInit(t);
+
+	CODE *code = codeCompile(t);
+	VALUE *v = eval(code->code, NULL);
+	TERM *res = v ? readback(v) : NULL;
+
+	readbackFinish(t, res);
+
+	*redno = reductions;
+	machineFreeAll();
+	codeFree(code);
+
+	return error ? -1 : 0;
+}
@@ -0,0 +1,11 @@
+// Declarations for machine.c
+// Copyright Kostas Chatzikokolakis
+
+#pragma once
+
+#include <stdint.h>
+
+#include "parser.h"
+
+
+int machineNormalize(TERM *t, int lazyEval, uint64_t *redno);
@@ -11,6 +11,7 @@
 #include "decllist.h"
 #include "str_intern.h"
 #include "termproc.h"
+#include "emit.h"
 
 #define MAX_HISTORY_ENTRIES 100
 
@@ -30,6 +31,17 @@ static void completion_or_hint(char const* context, replxx_completions* lc_compl
 
 int main(int argc, char *argv[]) {
 	char *home = getenv("HOME");
+	int status = 0;
+
+	// lci --terms-file path ... keeps the terms in the given file (see termSetFile)
+	if(argc >= 3 && strcmp(argv[1], "--terms-file") == 0) {
+		if(termSetFile(argv[2]) != 0) {
+			fprintf(stderr, "error: cannot create %s\n", argv[2]);
+			return 1;
+		}
+		argc -= 2;
+		argv += 2;
+	}
 
 	#ifndef __EMSCRIPTEN__
 	// load history from ~/lci_history (if HOME is available) or "./lci_history"
@@ -90,8 +102,23 @@ int main(int argc, char *argv[]) {
 			fprintf(stderr, "error: cannot load %s\n", argv[1]);
 		quit_called = 1;
 
+	} else if((argc == 3 || argc == 4) && strcmp(argv[1], "--emit-c") == 0) {
+		// write a C program executing the terms of the file (and the query) to stdout, see emit.c
+		emitBegin();
+		if(consultFile(argv[2]) != 0) {
+			fprintf(stderr, "error: cannot load %s\n", argv[2]);
+			status = 1;
+		} else if(argc == 4 && !parse_string(argv[3])) {
+			status = 1;
+		}
+		emitEnd();
+		if(status == 0)
+			emitProgram(stdout);
+		quit_called = 1;
+
 	} else {
-		fprintf(stderr, "syntax: lci [file]\n");
+		fprintf(stderr, "syntax: lci [--terms-file path] [file]\n");
+		fprintf(stderr, "        lci [--terms-file path] --emit-c file [term]\n");
 	}
 
 	// read and execute commands
@@ -125,10 +152,10 @@ int main(int argc, char *argv[]) {
 
 	// cleanup
 	decl_cleanup();
-	termGC();
+	termFreeAll();
 	str_intern_cleanup();
 
-	return 0;
+	return status;
 }
 
 
@@ -156,7 +183,7 @@ static void completion_or_hint(char const* context, replxx_completions* lc_compl
 
 	// if we are at the first word of the string, complete also system commands
 	if(start == context) {
-		char *commands[] = { "DefOp", "ShowAlias", "Print", "FixedPoint", "Consult", "Set", "Help", "Quit" };
+		char *commands[] = { "DefOp", "ShowAlias", "Print", "FixedPoint", "Consult", "Set", "Trim", "Help", "Quit" };
 		for(int i = 0; i < sizeof(commands)/sizeof(char*); i++) {
 
 			vector_insert_last(candidates, commands[i]);
@@ -0,0 +1,617 @@
+// vim:noet:ts=3
+
+// Normalization by evaluation
+// Copyright Kostas Chatzikokolakis
+//
+// The term is not rewritten at all. It is evaluated, directly on its tree,
+// into a semantic domain in which an abstraction is a C closure (the body
+// together with an environment holding its free variables) and a term that
+// cannot be reduced further is a neutral value (a variable applied to some
+// arguments). Applying a closure just extends its environment, so the
+// intermediate terms are never built. The normal form is then obtained by
+// "reading back" the value: a closure is applied to a fresh variable and the
+// result is read back recursively.
+//
+// Arguments are passed as thunks which are evaluated the first time they are
+// needed and then keep their value, otherwise terms like "True I Loop" or the
+// fixed point combinator would never terminate.
+//
+// Evaluation and readback are recursive C functions, so the objects used by
+// their local variables are registered as roots for the garbage collector.
+// Instead of reductions, the number of evaluation steps (terms visited by
+// eval) is counted.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "ADTMap.h"
+
+#include "nbe.h"
+#include "termproc.h"
+#include "decllist.h"
+#include "run.h"
+#include "str_intern.h"
+
+
+typedef struct thunk THUNK;
+typedef struct env ENV;
+typedef struct value VALUE;
+typedef struct variable VARIABLE;
+typedef struct arg ARG;
+
+// All objects start with a common header, used by the garbage collector
+typedef enum { OBJ_FREE, OBJ_THUNK, OBJ_ENV, OBJ_VALUE, OBJ_VARIABLE, OBJ_ARG } OBJ_TYPE;
+
+typedef struct {
+	char type;					// OBJ_TYPE
+	char mark;					// set during the mark phase if the object is reachable
+} HEADER;
+
+// A (possibly unevaluated) argument, shared by all occurrences of its variable
+struct thunk {
+	HEADER h;
+	TERM *term;					// the argument
+	ENV *env;					// and its environment
+	VALUE *value;				// NULL if not evaluated yet
+	char busy;					// 1 while being evaluated
+};
+
+// Thunks of the variables bound by the enclosing abstractions, the variable
+// with de Bruijn index i is bound to the i-th thunk of the list.
+struct env {
+	HEADER h;
+	THUNK *thunk;
+	ENV *next;
+};
+
+// A free variable, either of the original term or introduced when reading
+// back the body of a closure.
+struct variable {
+	HEADER h;
+	char *name;
+	int uses;					// number of occurrences in the read-back term
+};
+
+// arguments of a neutral value, most recent first
+struct arg {
+	HEADER h;
+	THUNK *thunk;
+	ARG *next;
+	char strict;				// 1 if applied with operator ~
+};
+
+typedef enum { VAL_CLOSURE, VAL_NEUTRAL } VALUE_TYPE;
+
+struct value {
+	HEADER h;
+	VALUE_TYPE type;
+	TERM *term;					// closure: the abstraction
+	ENV *env;					//          and its environment
+	VARIABLE *var;				// neutral: head variable
+	ARG *args;					//          and its arguments
+};
+
+// Objects are allocated in chunks, unused ones are kept in a free list
+typedef struct free_obj {
+	HEADER h;
+	struct free_obj *next;
+} FREE_OBJ;
+
+typedef union {
+	HEADER h;
+	THUNK thunk;
+	ENV env;
+	VALUE value;
+	VARIABLE var;
+	ARG arg;
+	FREE_OBJ free;
+} OBJECT;
+
+#define CHUNK_OBJECTS	(1 << 15)
+#define GC_MIN			(1 << 20)		// never collect before allocating that many objects
+
+typedef struct chunk {
+	struct chunk *next;
+	OBJECT objects[CHUNK_OBJECTS];
+} CHUNK;
+
+static CHUNK *chunks = NULL;
+static FREE_OBJ *freeList = NULL;
+static int allocated = 0, gcThreshold = GC_MIN;
+
+// addresses of the local variables of eval, force and readback which point
+// to objects, these must survive garbage collection
+static void ***roots = NULL;
+static int rootNo = 0, rootCapacity = 0;
+
+// arguments waiting for the value of the head of an application, and whether
+// they are applied with operator ~
+static THUNK **args = NULL;
+static char *argStrict = NULL;
+static int argNo = 0, argCapacity = 0;
+
+static Map aliasThunks = NULL;		// alias => THUNK, aliases are shared during an evaluation
+static Map freeThunks = NULL;		// name => THUNK holding the corresponding free variable
+
+static uint64_t steps;
+static int error;
+
+
+static VALUE *eval(TERM *t, ENV *env);
+static VALUE *force(THUNK *thunk);
+static TERM *readback(VALUE *v);
+
+
+static int compare_pointers(Pointer a, Pointer b) {
+	return a - b;
+}
+
+static void *nbeAlloc(OBJ_TYPE type) {
+	if(freeList == NULL) {
+		CHUNK *chunk = malloc(sizeof(CHUNK));
+		assert(chunk);
+		chunk->next = chunks;
+		chunks = chunk;
+
+		for(int i = CHUNK_OBJECTS-1; i >= 0; i--) {
+			FREE_OBJ *obj = &chunk->objects[i].free;
+			obj->h.type = OBJ_FREE;
+			obj->next = freeList;
+			freeList = obj;
+		}
+	}
+
+	OBJECT *obj = (OBJECT *)freeList;
+	freeList = freeList->next;
+	obj->h.type = type;
+	obj->h.mark = 0;
+	allocated++;
+	return obj;
+}
+
+// root is the address of a local variable pointing to an object
+
+static void pushRoot(void *root) {
+	if(rootNo == rootCapacity) {
+		rootCapacity = rootCapacity ? 2*rootCapacity : 100;
+		roots = realloc(roots, rootCapacity * sizeof(*roots));
+		assert(roots);
+	}
+	roots[rootNo++] = root;
+}
+
+static void popRoot() {
+	assert(rootNo > 0);
+	rootNo--;
+}
+
+static void nbeFreeAll() {
+	while(chunks) {
+		CHUNK *next = chunks->next;
+		free(chunks);
+		chunks = next;
+	}
+	freeList = NULL;
+	allocated = 0;
+	gcThreshold = GC_MIN;
+
+	free(roots);
+	roots = NULL;
+	rootNo = rootCapacity = 0;
+
+	free(args);
+	free(argStrict);
+	args = NULL;
+	argStrict = NULL;
+	argNo = argCapacity = 0;
+
+	map_destroy(aliasThunks);
+	map_destroy(freeThunks);
+	aliasThunks = freeThunks = NULL;
+}
+
+// Garbage collection
+//
+// Marks all objects reachable from the roots, the pending arguments and the
+// shared thunks of aliases and free variables. Unreachable objects are moved
+// to the free list. Note: uses an explicit stack, environments can be very long.
+
+static OBJECT **markStack = NULL;
+static int markNo = 0, markCapacity = 0;
+
+static inline void mark(void *p) {
+	OBJECT *obj = p;
+	if(obj == NULL || obj->h.mark)
+		return;
+
+	obj->h.mark = 1;
+	if(markNo == markCapacity) {
+		markCapacity = markCapacity ? 2*markCapacity : 1000;
+		markStack = realloc(markStack, markCapacity * sizeof(*markStack));
+		assert(markStack);
+	}
+	markStack[markNo++] = obj;
+}
+
+static void collect() {
+	for(int i = 0; i < rootNo; i++)
+		mark(*roots[i]);
+	for(int i = 0; i < argNo; i++)
+		mark(args[i]);
+	for(MapNode node = map_first(aliasThunks); node != MAP_EOF; node = map_next(aliasThunks, node))
+		mark(map_node_value(aliasThunks, node));
+	for(MapNode node = map_first(freeThunks); node != MAP_EOF; node = map_next(freeThunks, node))
+		mark(map_node_value(freeThunks, node));
+
+	while(markNo > 0) {
+		OBJECT *obj = markStack[--markNo];
+
+		switch(obj->h.type) {
+		 case OBJ_THUNK:
+			mark(obj->thunk.env);
+			mark(obj->thunk.value);
+			break;
+		 case OBJ_ENV:
+			mark(obj->env.thunk);
+			mark(obj->env.next);
+			break;
+		 case OBJ_VALUE:
+			mark(obj->value.env);
+			mark(obj->value.var);
+			mark(obj->value.args);
+			break;
+		 case OBJ_ARG:
+			mark(obj->arg.thunk);
+			mark(obj->arg.next);
+			break;
+		}
+	}
+
+	// sweep
+	allocated = 0;
+	freeList = NULL;
+	for(CHUNK *chunk = chunks; chunk != NULL; chunk = chunk->next) {
+		for(int i = 0; i < CHUNK_OBJECTS; i++) {
+			OBJECT *obj = &chunk->objects[i];
+			if(obj->h.mark) {
+				obj->h.mark = 0;
+				allocated++;
+			} else {
+				obj->h.type = OBJ_FREE;
+				obj->free.next = freeList;
+				freeList = &obj->free;
+			}
+		}
+	}
+
+	free(markStack);
+	markStack = NULL;
+	markNo = markCapacity = 0;
+
+	// next collection when the live objects are doubled
+	gcThreshold = 2*allocated > GC_MIN ? 2*allocated : GC_MIN;
+}
+
+static inline void pushArg(THUNK *thunk, int strict) {
+	if(argNo == argCapacity) {
+		argCapacity = argCapacity ? 2*argCapacity : 1000;
+		args = realloc(args, argCapacity * sizeof(*args));
+		argStrict = realloc(argStrict, argCapacity * sizeof(*argStrict));
+		assert(args && argStrict);
+	}
+	argStrict[argNo] = strict;
+	args[argNo++] = thunk;
+}
+
+static THUNK *newThunk(TERM *term, ENV *env, VALUE *value) {
+	THUNK *thunk = nbeAlloc(OBJ_THUNK);
+	thunk->term = term;
+	thunk->env = env;
+	thunk->value = value;
+	thunk->busy = 0;
+	return thunk;
+}
+
+static ENV *extend(ENV *env, THUNK *thunk) {
+	ENV *res = nbeAlloc(OBJ_ENV);
+	res->thunk = thunk;
+	res->next = env;
+	return res;
+}
+
+static VALUE *newClosure(TERM *term, ENV *env) {
+	VALUE *v = nbeAlloc(OBJ_VALUE);
+	v->type = VAL_CLOSURE;
+	v->term = term;
+	v->env = env;
+	v->var = NULL;
+	v->args = NULL;
+	return v;
+}
+
+static VALUE *newNeutral(VARIABLE *var, ARG *args) {
+	VALUE *v = nbeAlloc(OBJ_VALUE);
+	v->type = VAL_NEUTRAL;
+	v->term = NULL;
+	v->env = NULL;
+	v->var = var;
+	v->args = args;
+	return v;
+}
+
+static VARIABLE *newVariable(char *name) {
+	VARIABLE *var = nbeAlloc(OBJ_VARIABLE);
+	var->name = name;
+	var->uses = 0;
+	return var;
+}
+
+// Returns the thunk of a free variable, all its occurrences share the same thunk
+
+static THUNK *freeThunk(char *name) {
+	THUNK *thunk = map_find(freeThunks, name);
+	if(thunk == NULL) {
+		thunk = newThunk(NULL, NULL, newNeutral(newVariable(name), NULL));
+		map_insert(freeThunks, name, thunk);
+	}
+	return thunk;
+}
+
+// Returns the thunk of an alias. All occurrences of an alias share the same
+// thunk, so closed terms like "Nats 1" are computed only once. Declarations
+// are closed, so they are evaluated in the empty environment.
+
+static THUNK *aliasThunk(char *name) {
+	THUNK *thunk = map_find(aliasThunks, name);
+	if(thunk == NULL) {
+		TERM *term = getLiftedTerm(name);
+		if(term == NULL) {
+			printf("Error: Alias %s is not declared.\n", name);
+			error = 1;
+			return NULL;
+		}
+
+		thunk = newThunk(term, NULL, NULL);
+		map_insert(aliasThunks, name, thunk);
+	}
+	return thunk;
+}
+
+// Returns the thunk of term t in environment env. Variables and aliases already
+// have a thunk which is shared, abstractions are already values. As in normal
+// order, an undeclared alias is an error only if its value is needed, so it
+// gets a thunk of its own (forcing it reports the error).
+
+static THUNK *delay(TERM *t, ENV *env) {
+	switch(t->type) {
+	 case TM_VAR:
+		if(t->index >= 0) {
+			for(int i = t->index; i > 0; i--)
+				env = env->next;
+			return env->thunk;
+		}
+		return freeThunk(NAME(t));
+
+	 case TM_ALIAS:
+		if(map_find(aliasThunks, NAME(t)) == NULL && getLiftedTerm(NAME(t)) == NULL)
+			return newThunk(t, env, NULL);
+		return aliasThunk(NAME(t));
+
+	 case TM_ABSTR:
+		return newThunk(t, env, newClosure(t, env));
+
+	 default:
+		return newThunk(t, env, NULL);
+	}
+}
+
+// eval
+//
+// Evaluates t in environment env to a closure or a neutral value.
+// Returns NULL in case of error.
+
+static VALUE *eval(TERM *t, ENV *env) {
+	char *str_tilde = str_symbol(SYM_TILDE);
+
+	int base = argNo;			// arguments above base are applied to the value of t
+	VALUE *v;
+
+	pushRoot(&env);
+	readbackNest(&error);
+
+	while(!error) {
+		// safe point for garbage collection, all objects in use are reachable from roots and args
+		if(allocated > gcThreshold)
+			collect();
+
+		if(++steps % 1024 == 0 && trace) {
+			// SIGINT enables trace, which is not supported here, so the evaluation is aborted
+			printf("Interrupted.\n");
+			error = 1;
+			break;
+		}
+
+		// the spine of t, its arguments wait in args until the head is known
+		if(t->type == TM_APPL) {
+			pushArg(delay(RTERM(t), env), NAME(t) == str_tilde);
+
+			// call-by-value: the argument is evaluated before the application
+			if(NAME(t) == str_tilde && args[argNo-1] && !force(args[argNo-1]))
+				break;
+
+			t = LTERM(t);
+			continue;
+		}
+
+		if(t->type == TM_ABSTR) {
+			if(argNo == base) {
+				popRoot();
+				readbackUnnest();
+				return newClosure(t, env);
+			}
+
+			env = extend(env, args[--argNo]);
+			t = RTERM(t);
+			continue;
+		}
+
+		// the head is a variable or an alias, find its value
+		THUNK *thunk = t->type == TM_ALIAS ? aliasThunk(NAME(t)) : delay(t, env);
+		if(!thunk || !(v = force(thunk)))
+			break;
+
+		if(v->type == VAL_CLOSURE && argNo > base) {
+			env = extend(v->env, args[--argNo]);
+			t = RTERM(v->term);
+			continue;
+		}
+
+		// neutral values just collect their arguments
+		for(; argNo > base; argNo--) {
+			ARG *arg = nbeAlloc(OBJ_ARG);
+			arg->thunk = args[argNo-1];
+			arg->next = v->args;
+			arg->strict = argStrict[argNo-1];
+			v = newNeutral(v->var, arg);
+		}
+
+		popRoot();
+		readbackUnnest();
+		return v;
+	}
+
+	argNo = base;
+	popRoot();
+	readbackUnnest();
+	return NULL;
+}
+
+// force
+//
+// Returns the value of a thunk, evaluating it if needed
+
+static VALUE *force(THUNK *thunk) {
+	if(thunk->value != NULL)
+		return thunk->value;
+
+	// evaluating a thunk which is already being evaluated means that its value
+	// depends on itself (eg. Loop = Loop), so the evaluation would never terminate
+	if(thunk->busy) {
+		printf("Error: infinite loop detected, a term depends on its own value.\n");
+		error = 1;
+		return NULL;
+	}
+
+	pushRoot(&thunk);
+	thunk->busy = 1;
+	VALUE *v = eval(thunk->term, thunk->env);
+	thunk->value = v;
+	thunk->busy = 0;
+	popRoot();
+
+	return thunk->value;
+}
+
+// readbackNeutral
+//
+// Reads back a variable applied to args (most recent first)
+
+static TERM *readbackNeutral(VARIABLE *var, ARG *args) {
+	if(args == NULL) {
+		var->uses++;
+		return readbackTerm(TM_VAR, var->name, NULL, NULL);
+	}
+
+	TERM *lterm = readbackNest(&error) ? readbackNeutral(var, args->next) : NULL;
+	readbackUnnest();
+	VALUE *v = lterm ? force(args->thunk) : NULL;
+	TERM *rterm = v ? readback(v) : NULL;
+
+	if(rterm == NULL) {
+		termFree(lterm);
+		return NULL;
+	}
+	return readbackTerm(TM_APPL, args->strict ? str_symbol(SYM_TILDE) : NULL, lterm, rterm);
+}
+
+// readback
+//
+// Returns the normal form of value v, as a new term. A closure is applied to
+// a new variable and its result is read back. Eta-reductions are performed
+// here: in a beta-normal form they cannot create new redexes.
+
+static TERM *readback(VALUE *v) {
+	if(!readbackNest(&error)) {
+		readbackUnnest();
+		return NULL;
+	}
+
+	if(v->type == VAL_NEUTRAL) {
+		pushRoot(&v);
+		TERM *res = readbackNeutral(v->var, v->args);
+		popRoot();
+		readbackUnnest();
+		return res;
+	}
+
+	// keep the name of the abstraction, unless it would capture some other variable
+	char *name = readbackBind(NAME(v->term));
+
+	VARIABLE *var = newVariable(name);
+	THUNK *thunk = newThunk(NULL, NULL, newNeutral(var, NULL));
+
+	pushRoot(&var);
+	VALUE *bodyValue = eval(RTERM(v->term), extend(v->env, thunk));
+	TERM *body = bodyValue ? readback(bodyValue) : NULL;
+	readbackUnbind(name);
+	popRoot();
+	readbackUnnest();
+
+	if(body == NULL)
+		return NULL;
+
+	// eta-conversion: \x.M x -> M  if x not free in M
+	if(body->type == TM_APPL &&
+		RTERM(body)->type == TM_VAR &&
+		NAME(RTERM(body)) == name &&
+		var->uses == 1) {
+
+		TERM *M = LTERM(body);
+		SET_LTERM(body, NULL);
+		termFree(body);
+		steps++;
+		return M;
+	}
+
+	return readbackTerm(TM_ABSTR, name, NULL, body);
+}
+
+// nbeNormalize
+//
+// Computes the normal form of t by evaluation and readback, t is replaced by
+// its normal form. The number of evaluation steps is stored in stepno.
+//
+// Returns
+// 	0	If the normal form was computed
+// 	-1	If some error happened
+
+int nbeNormalize(TERM *t, uint64_t *stepno) {
+	aliasThunks = map_create(compare_pointers, NULL, NULL);
+	freeThunks = map_create(compare_pointers, NULL, NULL);
+	map_set_hash_function(aliasThunks, hash_pointer);
+	map_set_hash_function(freeThunks, hash_pointer);
+
+	error = 0;
+	steps = readbackInit(t);
+
+	VALUE *v = eval(t, NULL);
+	TERM *res = v ? readback(v) : NULL;
+
+	readbackFinish(t, res);
+
+	*stepno = steps;
+	nbeFreeAll();
+
+	return error ? -1 : 0;
+}
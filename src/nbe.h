@@ -0,0 +1,11 @@
+// Declarations for nbe.c
+// Copyright Kostas Chatzikokolakis
+
+#pragma once
+
+#include <stdint.h>
+
+#include "parser.h"
+
+
+int nbeNormalize(TERM *t, uint64_t *stepno);
@@ -47,7 +47,8 @@ int parse_string(char *source) {
 TERM *create_variable(char *name) {
 	TERM *t = termNew();
 	t->type = TM_VAR;
-	t->name = name;
+	SET_NAME(t, name);
+	t->index = VAR_NAMED;		// binder is found by termSetClosedFlag
 	t->closed = 0;
 	return t;
 }
@@ -55,7 +56,7 @@ TERM *create_variable(char *name) {
 TERM *create_alias(char *name) {
 	TERM *t = termNew();
 	t->type = TM_ALIAS;
-	t->name = name;
+	SET_NAME(t, name);
 	t->closed = 0;
 	return t;
 }
@@ -63,14 +64,14 @@ TERM *create_alias(char *name) {
 TERM *create_abstraction(char *var, TERM *right) {
 	TERM *t = termNew();
 	t->type = TM_ABSTR;
-	t->name = var;
-	t->rterm = right;
+	SET_NAME(t, var);
+	SET_RTERM(t, right);
 	t->closed = 0;
 	return t;
 }
 
 static void get_assoc_preced(TERM *t, int *preced, ASS_TYPE *assoc) {
-	OPER *oper = t->name != NULL ? getOper(t->name) : NULL;
+	OPER *oper = NAME(t) != NULL ? getOper(NAME(t)) : NULL;
 
 	if(oper == NULL) {
 		*preced = APPL_PRECED;
@@ -92,7 +93,7 @@ static void get_assoc_preced(TERM *t, int *preced, ASS_TYPE *assoc) {
 //       but couldn't make it to work.
 
 static TERM *fix_precedence(TERM* op) {
-	TERM *left = op->lterm;
+	TERM *left = LTERM(op);
 	if(left->type != TM_APPL || left->closed)	// "closed" means it is protected by parenthesis
 		return op;
 
@@ -118,23 +119,23 @@ static TERM *fix_precedence(TERM* op) {
 			breakOp = 1;
 		else if(op_assoc != ASS_LEFT)
 			fprintf(stderr, "Warning: Precedence ambiguity between operators '%s' and '%s'. Use brackets.\n",
-				(op->name ? op->name : "APPL"), (left->name ? left->name : "APPL"));
+				(NAME(op) ? NAME(op) : "APPL"), (NAME(left) ? NAME(left) : "APPL"));
 	}
 
 	if(!breakOp)
 		return op;
 
-	op->lterm = left->rterm;
-	left->rterm = fix_precedence(op);
+	SET_LTERM(op, RTERM(left));
+	SET_RTERM(left, fix_precedence(op));
 	return left;
 }
 
 TERM *create_application(TERM *left, char *oper_name, TERM *right) {
 	TERM *t = termNew();
 	t->type = TM_APPL;
-	t->name = oper_name;
-	t->lterm = left;
-	t->rterm = right;
+	SET_NAME(t, oper_name);
+	SET_LTERM(t, left);
+	SET_RTERM(t, right);
 	t->closed = 0;
 
 	t = fix_precedence(t);
@@ -147,9 +148,9 @@ TERM *create_application(TERM *left, char *oper_name, TERM *right) {
 TERM *create_number(char *s) {
 	int num = atoi(s);
 
-	TERM *t = create_alias(str_intern("0"));
+	TERM *t = create_alias(str_symbol(SYM_ZERO));
 	for(; num > 0; num--)
-		t = create_application(create_alias(str_intern("Succ")), NULL, t);
+		t = create_application(create_alias(str_symbol(SYM_SUCC)), NULL, t);
 
 	t->closed = 1;		// enclose in parenthesis, to avoid operators 'entering' inside 'Succ T'
 	return t;
@@ -163,17 +164,17 @@ TERM* create_bracket(TERM *t) {
 TERM *create_let(char *var, char *eq, TERM *value, TERM *t) {
 	return create_application(
 		create_abstraction(var, t),
-		(eq == str_intern("~=") ? str_intern("~") : NULL),
+		(eq == str_symbol(SYM_TILDE_EQ) ? str_symbol(SYM_TILDE) : NULL),
 		value
 	);
 }
 
 // Syntactic sugar for Term1:(Term2:(...:(Term<n>:Nil)))
 TERM *create_list(TERM *first, D_ParseNode *rest) {
-	TERM *list = create_alias(str_intern("Nil"));
+	TERM *list = create_alias(str_symbol(SYM_NIL));
 
 	if(first != NULL) {
-		char *str_colon = str_intern(":");
+		char *str_colon = str_symbol(SYM_COLON);
 		for(int i = d_get_number_of_children(rest) - 1; i >= 0; i--) {
 			TERM *t = d_get_child(d_get_child(rest, i), 1)->user;
 			t->closed = 1;			// ensure that operators inside t have higher precedence than ":"
@@ -8,11 +8,11 @@
 #include "dparse.h"
 
 // Add __attribute__((packed)) if compiler supports it
-// #if defined(__GNUC__) || defined(__clang__)
-// #define ATTR_PACKED __attribute__((packed))
-// #else
+#if defined(__GNUC__) || defined(__clang__)
+#define ATTR_PACKED __attribute__((packed))
+#else
 #define ATTR_PACKED
-// #endif
+#endif
 
 // Precedence and associativity of applications
 #define APPL_PRECED	100
@@ -24,9 +24,97 @@
 
 // Note: ATTR_PACKED (#defined __atribute__((packed))) instructs the compiler to
 // use 1 byte instead of 4 for the enum
-typedef enum { TM_ABSTR, TM_APPL, TM_VAR, TM_ALIAS } ATTR_PACKED TERM_TYPE;
+typedef enum { TM_ABSTR, TM_APPL, TM_VAR, TM_ALIAS, TM_SUBST } ATTR_PACKED TERM_TYPE;
 typedef enum { ASS_LEFT, ASS_RIGHT, ASS_NONE } ATTR_PACKED ASS_TYPE;
 
+// Terms are executed in the "locally nameless" representation: a bound variable
+// is identified by its de Bruijn index (the number of abstractions between the
+// variable and its binder), free variables are identified by their name. So
+// reductions never need to compare or rename variables. The names of
+// abstractions are only kept as hints, termPrint restores the names of bound
+// variables (renaming them if needed).
+//
+// For other terms, index is the largest index of a variable bound outside the
+// term (relative to the term), or VAR_FREE if there is none. Substitutions skip
+// terms whose variables are all bound inside the redex.
+//
+// The parser creates all variables with index VAR_NAMED, termSetClosedFlag
+// later finds their binders and sets the indexes.
+//
+// TM_SUBST terms only appear during execution with explicit substitutions
+// (STRAT_EXPLICIT). Such a term is a closure M[x:=N], with lterm = M and
+// rterm = N, that stands for termSubst(M, N, depth): x is the variable with
+// index depth in M and name is only a hint for printing (see termSubstStep).
+//
+// Other terms keep in depth their free mask, FREE_MASK(t): bit i is set if the
+// variable with index i < FREE_BITS (relative to the term) might be free in it.
+// The mask is computed together with index and, as index, it is only an upper
+// bound after reductions inside the term: a clear bit is certain, a set one
+// is not (see termIsFreeIndex).
+//
+// During execution, normal is set on terms which termConv has searched without
+// finding a redex (they also contain no aliases or closures), later searches
+// skip them. Copies of such a term keep the flag, functions that modify a term
+// in place clear it.
+#define VAR_FREE	-1						// free variable (identified by name)
+#define VAR_NAMED	-2						// binder not resolved yet
+
+#define FREE_MASK(t)	((t)->depth)
+#define FREE_ALL		((1u << FREE_BITS) - 1)		// every variable might be free
+
+#ifdef COMPACT_TERMS
+
+// With COMPACT_TERMS (cmake -DCOMPACT_TERMS=ON) all terms are kept in a single
+// array (termNodes), children are 32-bit indexes in it and names are 32-bit ids
+// of interned strings, so a term takes 16 bytes instead of 32. The index must
+// fit in 18 bits and the depth of closures (or the free mask) in 8.
+//
+// In both layouts lterm, rterm and name are accessed only through the macros
+// below.
+
+#include <stdint.h>
+#include "str_intern.h"
+
+#define DEPTH_MAX	255						// largest depth of a closure
+#define FREE_BITS	8						// bits of the free mask
+
+typedef uint32_t TERM_REF;					// index in termNodes, 0 for NULL
+
+typedef struct term_tag {
+	TERM_REF lref;							// left and right children
+	TERM_REF rref;							// (for applications and abstractions)
+	uint32_t nameId;						// id of the interned name (see str_intern_id)
+	int index : 18;							// de Bruijn index (for variables), largest one bound outside (for other terms)
+	unsigned depth : 8;						// index of the substituted variable (for closures), free mask (for other terms)
+	TERM_TYPE type : 3;						// variable, application or abstraction
+	unsigned closed : 1;					// 1 if application in parenthesis (parsing), or if no free vars (execution)
+	unsigned shared : 1;					// 1 if part of a frozen declaration (see termFreeze)
+	unsigned normal : 1;					// 1 if known to contain no redex (execution)
+} TERM;
+
+extern TERM *termNodes;
+
+static inline TERM *termPtr(TERM_REF ref) {
+	return ref ? termNodes + ref : NULL;
+}
+
+static inline TERM_REF termRef(TERM *t) {
+	return t ? (TERM_REF)(t - termNodes) : 0;
+}
+
+#define LTERM(t)			termPtr((t)->lref)
+#define RTERM(t)			termPtr((t)->rref)
+#define NAME(t)				str_intern_name((t)->nameId)
+#define SET_LTERM(t, x)		((t)->lref = termRef(x))
+#define SET_RTERM(t, x)		((t)->rref = termRef(x))
+#define SET_NAME(t, x)		((t)->nameId = str_intern_id(x))
+#define COPY_NAME(t, from)	((t)->nameId = (from)->nameId)
+
+#else
+
+#define DEPTH_MAX	65535					// largest depth of a closure
+#define FREE_BITS	16						// bits of the free mask
+
 // Note: put bigger fields first (lterm, rterm, name) to allow
 // the compiler to align the struct without wasting space.
 // results in a smaller sizeof(TERM)
@@ -35,9 +123,23 @@ typedef struct term_tag {
 	struct term_tag *lterm;					// left and right children
 	struct term_tag *rterm;					// (for applications and abstractions)
 	char *name;								// name (for variables, aliases and applications with an operator)
+	int index;								// de Bruijn index (for variables), largest one bound outside (for other terms)
+	unsigned short depth;					// index of the substituted variable (for closures), free mask (for other terms)
 	TERM_TYPE type;							// variable, application or abstraction
-	char closed;							// during parsing: 1 if application in parenthesis. during execution: 1 if no free vars
-} ATTR_PACKED TERM;
+	unsigned char closed : 1;				// during parsing: 1 if application in parenthesis. during execution: 1 if no free vars (incl. vars bound outside the term)
+	unsigned char shared : 1;				// 1 if part of a frozen declaration (see termFreeze)
+	unsigned char normal : 1;				// 1 if known to contain no redex (during execution)
+} TERM;
+
+#define LTERM(t)			((t)->lterm)
+#define RTERM(t)			((t)->rterm)
+#define NAME(t)				((t)->name)
+#define SET_LTERM(t, x)		((t)->lterm = (x))
+#define SET_RTERM(t, x)		((t)->rterm = (x))
+#define SET_NAME(t, x)		((t)->name = (x))
+#define COPY_NAME(t, from)	((t)->name = (from)->name)
+
+#endif
 
 
 int parse_string(char *source);
@@ -32,11 +32,20 @@
 #include "parser.h"
 #include "termproc.h"
 #include "decllist.h"
+#include "machine.h"
+#include "inet.h"
+#include "nbe.h"
+#include "emit.h"
 #include "str_intern.h"
 
 
+// reductions between calls to termCompact (0 to disable), can be set when compiling
+#ifndef COMPACT_INTERVAL
+#define COMPACT_INTERVAL	1000000
+#endif
+
 int trace;
-int options[OPTNO] = {0, 0, 0, 0, 1};
+int options[OPTNO] = {0, 0, 0, 0, 1, STRAT_NORMAL, 0};
 int quit_called = 0;
 
 #ifndef NDEBUG
@@ -82,8 +91,11 @@ static int read_single_char() {
 }
 
 void execTerm(TERM *t) {
-	int redno = -1, res = 1,
+	long long redno = -1,			// evaluation steps with nbe might not fit in an int
+		nextCompact = COMPACT_INTERVAL;
+	int res = 1,
 		showExec = getOption(OPT_SHOWEXEC);
+	char *counted = "reductions";
 	long stime = clock();
 	char c;
 
@@ -104,65 +116,111 @@ void execTerm(TERM *t) {
 
 	switch(execSystemCmd(t)) {
 	 case 1:
+		// with lci --emit-c the term is kept for the generated program
+		if(emitCapture(t))
+			break;
+
 		// during execution, SIGINT signals enable trace
 		signal(SIGINT, sigHandler);
 
-		// perform all reductions
-		do {
-			redno++;
-
-			#ifdef __EMSCRIPTEN__
-			// occasionally do an async call to find out whether Ctrl-C was pressed.
-			// This also gives back control to the browser to allow for responsiveness.
-			if(redno % 100 == 0 && (emscripten_get_now() - last_ctrl_c) > 400) {
-				if(js_read_ctrl_c())
-					trace = 1;
-				last_ctrl_c = emscripten_get_now();
-			}
-			#endif
-
-			if(trace) {
-				termPrint(t, 1);
-				printf("  ?> ");
-				fflush(stdout);
-				do {
-					switch(c = read_single_char()) {
-					 case 'c':
-						 printf("continue\n");
-						 trace = 0;
-						 break;
-					 case 's':
-						 printf("step\n");
-						 break;
-					 case 'a':
-					 case EOF:
-						 printf("abort\n");
-						 break;
-					 default:
-						 c = '?';
-						 printf("\nCommands: (s)tep, (c)ontinue, (a)bort  ?> ");
-						 fflush(stdout);
-					}
-				} while(c == '?');
-
-				if(c == 'a' || c == EOF)
-					break;
-
-			} else if(showExec) {
-				termPrint(t, 1);
-				printf("\n");
-			}
-
-		} while((res = termConv(t)) == 1);
+		if(getOption(OPT_STRATEGY) == STRAT_NBE && !trace && !showExec) {
+			// no intermediate terms exist, evaluation steps are counted instead of reductions
+			uint64_t steps;
+			res = nbeNormalize(t, &steps);
+			redno = steps;
+			counted = "evaluation steps";
+
+		} else if(getOption(OPT_STRATEGY) == STRAT_OPTIMAL && !trace && !showExec) {
+			// as with the machine below, the intermediate terms cannot be shown
+			uint64_t n;
+			res = inetNormalize(t, &n);
+			redno = n;
+
+		} else if((getOption(OPT_STRATEGY) == STRAT_NAME || getOption(OPT_STRATEGY) == STRAT_NEED) && !trace && !showExec) {
+			// the abstract machine computes the normal form in one go, it cannot show
+			// the intermediate terms (tracing always uses normal order)
+			uint64_t n;
+			res = machineNormalize(t, getOption(OPT_STRATEGY) == STRAT_NEED, &n);
+			redno = n;
+
+		} else {
+			// perform all reductions (with explicit substitutions if STRAT_EXPLICIT, see termConv)
+			termConvReset();
+			do {
+				redno += res;			// termConv can perform many reductions at once
+
+				#ifdef __EMSCRIPTEN__
+				// occasionally do an async call to find out whether Ctrl-C was pressed.
+				// This also gives back control to the browser to allow for responsiveness.
+				if(redno % 100 < res && (emscripten_get_now() - last_ctrl_c) > 400) {
+					if(js_read_ctrl_c())
+						trace = 1;
+					last_ctrl_c = emscripten_get_now();
+				}
+				#endif
+
+				// after many reductions the term is scattered in memory
+				if(COMPACT_INTERVAL > 0 && redno >= nextCompact) {
+					termCompact(t);
+					nextCompact = redno + COMPACT_INTERVAL;
+				}
+
+				if(trace) {
+					termPrint(t, 1);
+					printf("  ?> ");
+					fflush(stdout);
+					do {
+						switch(c = read_single_char()) {
+						 case 'c':
+							 printf("continue\n");
+							 trace = 0;
+							 break;
+						 case 's':
+							 printf("step\n");
+							 break;
+						 case 'a':
+						 case EOF:
+							 printf("abort\n");
+							 break;
+						 default:
+							 c = '?';
+							 printf("\nCommands: (s)tep, (c)ontinue, (a)bort  ?> ");
+							 fflush(stdout);
+						}
+					} while(c == '?');
+
+					if(c == 'a' || c == EOF)
+						break;
+
+				} else if(showExec) {
+					termPrint(t, 1);
+					printf("\n");
+				}
+
+			} while((res = termConv(t)) > 0);
+		}
 
 		// if execution is finished, print result
 		if(res == 0) {
 			printf("\n");
 			termPrint(t, 1);
-			printf("\n(%d reductions, %.2fs CPU)\n",
-				redno, (double)(clock()-stime) / CLOCKS_PER_SEC);
+			printf("\n(%lld %s, %.2fs CPU)\n",
+				redno, counted, (double)(clock()-stime) / CLOCKS_PER_SEC);
 #ifndef NDEBUG
 			printf("%d termIsFree's\n", freeNo);
+
+			int chunkNo, peak;
+			termStats(&chunkNo, &peak);
+			printf("%d term chunks, at most %d terms used\n", chunkNo, peak);
+
+			int compactNo;
+			double compactTime;
+			termCompactStats(&compactNo, &compactTime);
+			printf("%d compactions, %.2fs\n", compactNo, compactTime);
+
+			unsigned long hits, misses;
+			termPoolStats(&hits, &misses);
+			printf("%lu terms reused, %lu new chunks\n", hits, misses);
 #endif
 		}
 
@@ -200,13 +258,15 @@ void execTerm(TERM *t) {
 // 	-2 If the term is a Quit system command
 
 typedef enum {
-	STR_DEFOP, STR_SHOWALIAS, STR_PRINT, STR_FIXPOINT, STR_CONSULT, STR_SET, STR_HELP, STR_QUIT,
-	STR_XFX, STR_YFX, STR_XFY, STR_TRACE, STR_SHOWPAR, STR_GREEKLAMBDA, STR_SHOWEXEC, STR_READABLE, STR_ON, STR_OFF
+	STR_DEFOP, STR_SHOWALIAS, STR_PRINT, STR_FIXPOINT, STR_CONSULT, STR_SET, STR_TRIM, STR_HELP, STR_QUIT,
+	STR_XFX, STR_YFX, STR_XFY, STR_TRACE, STR_SHOWPAR, STR_GREEKLAMBDA, STR_SHOWEXEC, STR_READABLE, STR_HASHCONS, STR_ON, STR_OFF,
+	STR_STRATEGY, STR_NORMAL, STR_NAME, STR_NEED, STR_OPTIMAL, STR_EXPLICIT, STR_NBE
 } STR_CONSTANTS;
 
 static char* str_constants[] = {
-	"DefOp", "ShowAlias", "Print", "FixedPoint", "Consult", "Set", "Help", "Quit",
-	"xfx", "yfx", "xfy", "trace", "showpar", "greeklambda", "showexec", "readable", "on", "off"
+	"DefOp", "ShowAlias", "Print", "FixedPoint", "Consult", "Set", "Trim", "Help", "Quit",
+	"xfx", "yfx", "xfy", "trace", "showpar", "greeklambda", "showexec", "readable", "hashcons", "on", "off",
+	"strategy", "normal", "name", "need", "optimal", "explicit", "nbe"
 };
 
 int execSystemCmd(TERM *t) {
@@ -221,16 +281,16 @@ int execSystemCmd(TERM *t) {
 
 	// find the left-most term and keep params in the stack
 	while(t->type == TM_APPL) {
-		*sp++ = t->rterm;
+		*sp++ = RTERM(t);
 		parno++;
-		t = t->lterm;
+		t = LTERM(t);
 	}
 
 	// the left-most term must be one of the predefined aliases
 	if(t->type != TM_ALIAS)
 		return 1;
 
-	if(t->name == icon[STR_DEFOP]) {
+	if(NAME(t) == icon[STR_DEFOP]) {
 		// DefOp name preced assoc
 		//
 		// Stores an operator's declaration
@@ -243,7 +303,7 @@ int execSystemCmd(TERM *t) {
 		// param 1: operator
 		par = *--sp;
 		if(par->type != TM_ALIAS) return -1;
-		oper = par->name;
+		oper = NAME(par);
 
 		// param 2: precedence
 		par = *--sp;
@@ -253,11 +313,11 @@ int execSystemCmd(TERM *t) {
 		// param 3: associativity
 		par = *--sp;
 		if(par->type != TM_ALIAS && par->type != TM_VAR) return -1;
-		if(par->name == icon[STR_XFX])
+		if(NAME(par) == icon[STR_XFX])
 			ass = ASS_NONE;
-		else if(par->name == icon[STR_YFX])
+		else if(NAME(par) == icon[STR_YFX])
 			ass = ASS_LEFT;
-		else if(par->name == icon[STR_XFY])
+		else if(NAME(par) == icon[STR_XFY])
 			ass = ASS_RIGHT;
 		else
 			return -1;
@@ -265,7 +325,7 @@ int execSystemCmd(TERM *t) {
 		// add the operator's declaration
 		addOper(str_intern(oper), prec, ass);
 
-	} else if(t->name == icon[STR_SHOWALIAS]) {
+	} else if(NAME(t) == icon[STR_SHOWALIAS]) {
 		// ShowAlias
 		//
 		// Prints the definition of all stored aliases, or of a specific one
@@ -276,12 +336,12 @@ int execSystemCmd(TERM *t) {
 		if(parno == 1) {
 			par = *--sp;
 			if(par->type != TM_ALIAS) return -1;
-			id = par->name;
+			id = NAME(par);
 		}
 
 		printDeclList(id);
 
-	} else if(t->name == icon[STR_PRINT]) {
+	} else if(NAME(t) == icon[STR_PRINT]) {
 		// Print
 		//
 		// Prints the term given as a parameter
@@ -290,7 +350,7 @@ int execSystemCmd(TERM *t) {
 		termPrint(*--sp, 1);
 		printf("\n");
 
-	} else if(t->name == icon[STR_FIXPOINT]) {
+	} else if(NAME(t) == icon[STR_FIXPOINT]) {
 		// FixedPoint
 		//
 		// Removes recursion from aliases using a fixed point combinator
@@ -306,7 +366,7 @@ int execSystemCmd(TERM *t) {
 		else
 			printf("No cycles found\n");
 
-	} else if(t->name == icon[STR_CONSULT]) {
+	} else if(NAME(t) == icon[STR_CONSULT]) {
 		// Consult file
 		//
 		// Reads a file and executes its commands
@@ -315,16 +375,16 @@ int execSystemCmd(TERM *t) {
 		par = *--sp;
 		if(par->type != TM_ALIAS && par->type != TM_VAR) return -1;
 
-		switch(consultFile(par->name)) {
+		switch(consultFile(NAME(par))) {
 		 case 0:
-			printf("Successfully consulted %s\n", par->name);
+			printf("Successfully consulted %s\n", NAME(par));
 			break;
 		 case -1:
-			printf("Error: cannot open %s\n", par->name);
+			printf("Error: cannot open %s\n", NAME(par));
 			break;
 		}
 
-	} else if(t->name == icon[STR_SET]) {
+	} else if(NAME(t) == icon[STR_SET]) {
 		// Set option value
 		//
 		// Changes the value of an option
@@ -335,29 +395,64 @@ int execSystemCmd(TERM *t) {
 
 		par = *--sp;
 		if(par->type != TM_VAR) return -1;
-		if(par->name == icon[STR_TRACE])
+		if(NAME(par) == icon[STR_TRACE])
 			opt = OPT_TRACE;
-		else if(par->name == icon[STR_SHOWPAR])
+		else if(NAME(par) == icon[STR_SHOWPAR])
 			opt = OPT_SHOWPAR;
-		else if(par->name == icon[STR_GREEKLAMBDA])
+		else if(NAME(par) == icon[STR_GREEKLAMBDA])
 			opt = OPT_GREEKLAMBDA;
-		else if(par->name == icon[STR_SHOWEXEC])
+		else if(NAME(par) == icon[STR_SHOWEXEC])
 			opt = OPT_SHOWEXEC;
-		else if(par->name == icon[STR_READABLE])
+		else if(NAME(par) == icon[STR_READABLE])
 			opt = OPT_READABLE;
+		else if(NAME(par) == icon[STR_STRATEGY])
+			opt = OPT_STRATEGY;
+		else if(NAME(par) == icon[STR_HASHCONS])
+			opt = OPT_HASHCONS;
 		else
 			return -1;
 
 		par = *--sp;
-		if(par->name == icon[STR_ON])
+		if(opt == OPT_STRATEGY) {
+			if(NAME(par) == icon[STR_NORMAL])
+				value = STRAT_NORMAL;
+			else if(NAME(par) == icon[STR_NAME])
+				value = STRAT_NAME;
+			else if(NAME(par) == icon[STR_NEED])
+				value = STRAT_NEED;
+			else if(NAME(par) == icon[STR_OPTIMAL])
+				value = STRAT_OPTIMAL;
+			else if(NAME(par) == icon[STR_EXPLICIT])
+				value = STRAT_EXPLICIT;
+			else if(NAME(par) == icon[STR_NBE])
+				value = STRAT_NBE;
+			else return -1;
+
+		} else if(NAME(par) == icon[STR_ON])
 			value = 1;
-		else if(par->name == icon[STR_OFF])
+		else if(NAME(par) == icon[STR_OFF])
 			value = 0;
 		else return -1;
 
 		options[opt] = value;
 
-	} else if(t->name == icon[STR_HELP]) {
+	} else if(NAME(t) == icon[STR_TRIM]) {
+		// Trim
+		//
+		// Releases the unused chunks of terms (see termTrim)
+		unsigned long hits, misses;
+
+		if(parno != 0) return -1;
+
+		int released = termTrim(0);
+		termPoolStats(&hits, &misses);
+
+		int chunkNo, peak;
+		termStats(&chunkNo, &peak);
+		printf("%d term chunks released, %d kept (%lu terms reused, %lu new chunks)\n",
+			released, chunkNo, hits, misses);
+
+	} else if(NAME(t) == icon[STR_HELP]) {
 		// Help
 		//
 		// Prints help message
@@ -370,11 +465,13 @@ int execSystemCmd(TERM *t) {
 		printf("ShowAlias [name]\tList the specified or all stored aliases\n");
 		printf("Print term\t\tDisplays the term\n");
 		printf("Consult file\t\tReads and interprets the specified file\n");
-		printf("Set option (on|off)\tChanges one of the following options:\n\t\t\ttrace, showexec, showpar, greeklambda, readable\n");
+		printf("Set option (on|off)\tChanges one of the following options:\n\t\t\ttrace, showexec, showpar, greeklambda, readable, hashcons\n");
+		printf("Set strategy s\t\tChanges the evaluation strategy:\n\t\t\tnormal, name, need, optimal, explicit, nbe\n");
+		printf("Trim\t\t\tReleases unused memory\n");
 		printf("Help\t\t\tDisplays this message\n");
 		printf("Quit\t\t\tQuit the program (same as Ctrl-D)\n\n");
 
-	} else if(t->name == icon[STR_QUIT]) {
+	} else if(NAME(t) == icon[STR_QUIT]) {
 		if(parno != 0) return -1;
 		return -2;
 
@@ -430,6 +527,13 @@ int getOption(OPT opt) {
 	return options[opt]; 
 }
 
+// setOption
+//
+// Changes the value of option opt (as the Set command)
+void setOption(OPT opt, int value) {
+	options[opt] = value;
+}
+
 // sigHandler
 //
 // Handles SIGINT signal during execution. It enables the trace functionality.
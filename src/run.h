@@ -5,15 +5,20 @@
 
 #include "parser.h"
 
-#define OPTNO	5
-typedef enum {OPT_TRACE = 0, OPT_SHOWPAR, OPT_GREEKLAMBDA, OPT_SHOWEXEC, OPT_READABLE} OPT;
+#define OPTNO	7
+typedef enum {OPT_TRACE = 0, OPT_SHOWPAR, OPT_GREEKLAMBDA, OPT_SHOWEXEC, OPT_READABLE, OPT_STRATEGY, OPT_HASHCONS} OPT;
+
+// values of OPT_STRATEGY
+typedef enum {STRAT_NORMAL = 0, STRAT_NAME, STRAT_NEED, STRAT_OPTIMAL, STRAT_EXPLICIT, STRAT_NBE} STRATEGY;
 
 extern int quit_called;
+extern int trace;
 
 
 void execTerm(TERM *t);
 int execSystemCmd(TERM *t);
 int consultFile(char *fname);
 int getOption(OPT opt);
+void setOption(OPT opt, int value);
 
 void sigHandler(int sig);
@@ -1,46 +1,202 @@
-// Basic string interning utilities
-// Copyright Kostas Chatzikokolakis and Stefanos Baziotis
-
-#include <assert.h>
-#include <stdlib.h>
-#include <string.h>
-
-#include "ADTMap.h"
-#include "str_intern.h"
-
-// -------------- STRING INTERNING -----------------
-
-Map interns = NULL;
-
-char *str_intern(char *str) {
-    if(str == NULL)
-        return NULL;
-    
-    if(interns == NULL) {
-        interns = map_create((CompareFunc)strcmp, free, NULL);
-        map_set_hash_function(interns, hash_string);
-    }
-
-    char* res = map_find(interns, str);
-
-    if(res == NULL) {
-        res = strdup(str);
-        map_insert(interns, res, res);
-    }
-
-    return res;
-}
-
-char *str_intern_range(char *start, char *end) {
-    char old = *end;
-    *end = '\0';                    // quick and dirty
-    char *res = str_intern(start);  // the string is copied
-    *end = old;                     // restore
-    return res;
-}
-
-void str_intern_cleanup() {
-    if(interns != NULL)
-        map_destroy(interns);
-    interns = NULL;
-}
+// Basic string interning utilities
+// Copyright Kostas Chatzikokolakis and Stefanos Baziotis
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "str_intern.h"
+
+// -------------- STRING INTERNING -----------------
+//
+// Interned strings are copied in an arena (large blocks which are released
+// only by str_intern_cleanup), each one preceded by its id. The table is an
+// open addressing hash table of ids, the hash of each string is computed once
+// and kept in 'hashes' (by id), so the table is enlarged without hashing the
+// strings again. Lookups take the string as (pointer, length), so substrings
+// of a buffer (eg. the tokens of the parser) are interned without copying or
+// modifying them.
+
+#define ARENA_BLOCK     (64 * 1024)         // size of the arena blocks (larger strings get their own)
+
+// The well-known strings, interned in advance with fixed ids (see STR_SYMBOL)
+STR_SYMBOL_ENTRY str_symbols[SYM_COUNT] = {
+    { 0, "" },
+    { SYM_ZERO, "0" },
+    { SYM_SUCC, "Succ" },
+    { SYM_NIL, "Nil" },
+    { SYM_COLON, ":" },
+    { SYM_TILDE, "~" },
+    { SYM_TILDE_EQ, "~=" },
+    { SYM_Y, "Y" },
+    { SYM_ME, "_me" },
+};
+
+typedef struct arena_block {
+    struct arena_block *next;
+    char mem[];
+} ARENA_BLOCK_T;
+
+char **str_interned = NULL;         // id => string, id 0 is NULL
+static uint32_t *hashes = NULL;     // id => hash of the string
+static uint32_t internedNo = 0, internedCapacity = 0;
+
+static uint32_t *table = NULL;      // ids, 0 for empty slots
+static uint32_t tableCapacity = 0;  // power of 2, at least twice internedNo
+
+static ARENA_BLOCK_T *blocks = NULL;
+static char *arenaNext = NULL, *arenaEnd = NULL;      // the unused part of the last block
+
+
+// FNV-1a
+
+static uint32_t hash_range(const char *str, size_t len) {
+    uint32_t hash = 2166136261u;
+    for(size_t i = 0; i < len; i++)
+        hash = (hash ^ (unsigned char)str[i]) * 16777619u;
+    return hash;
+}
+
+// Returns a new block of the arena with at least size bytes
+
+static char *arena_block(size_t size) {
+    ARENA_BLOCK_T *block = malloc(sizeof(ARENA_BLOCK_T) + size);
+    assert(block);
+    block->next = blocks;
+    blocks = block;
+    return block->mem;
+}
+
+// Copies the string in the arena, preceded by the id
+
+static char *arena_add(const char *str, size_t len, uint32_t id) {
+    size_t size = sizeof(uint32_t) + len + 1;
+
+    // keep the ids aligned
+    arenaNext += -(uintptr_t)arenaNext & (sizeof(uint32_t) - 1);
+
+    char *mem;
+    if(arenaNext != NULL && arenaEnd - arenaNext >= (ptrdiff_t)size) {
+        mem = arenaNext;
+        arenaNext += size;
+    } else if(size > ARENA_BLOCK / 4) {
+        mem = arena_block(size);            // the rest of the last block is still used
+    } else {
+        mem = arena_block(ARENA_BLOCK);
+        arenaNext = mem + size;
+        arenaEnd = mem + ARENA_BLOCK;
+    }
+
+    *(uint32_t *)mem = id;
+    char *res = mem + sizeof(uint32_t);
+    memcpy(res, str, len);
+    res[len] = '\0';
+    return res;
+}
+
+// Places id in the table, which must not contain the string
+
+static void table_insert(uint32_t id) {
+    uint32_t pos = hashes[id] & (tableCapacity - 1);
+    while(table[pos] != 0)
+        pos = (pos + 1) & (tableCapacity - 1);
+    table[pos] = id;
+}
+
+// Adds a new id for the string
+
+static void intern_add(char *str, uint32_t hash) {
+    if(internedNo == internedCapacity) {
+        internedCapacity *= 2;
+        str_interned = realloc(str_interned, internedCapacity * sizeof(*str_interned));
+        hashes = realloc(hashes, internedCapacity * sizeof(*hashes));
+        assert(str_interned && hashes);
+    }
+
+    uint32_t id = internedNo++;
+    str_interned[id] = str;
+    hashes[id] = hash;
+
+    if(2 * internedNo > tableCapacity) {
+        free(table);
+        tableCapacity *= 2;
+        table = calloc(tableCapacity, sizeof(*table));
+        assert(table);
+
+        for(uint32_t i = 1; i < internedNo; i++)
+            table_insert(i);
+    } else {
+        table_insert(id);
+    }
+}
+
+static void intern_init() {
+    internedCapacity = 1024;
+    str_interned = malloc(internedCapacity * sizeof(*str_interned));
+    hashes = malloc(internedCapacity * sizeof(*hashes));
+    assert(str_interned && hashes);
+    str_interned[0] = NULL;
+    hashes[0] = 0;
+    internedNo = 1;
+
+    tableCapacity = 2 * internedCapacity;
+    table = calloc(tableCapacity, sizeof(*table));
+    assert(table);
+
+    // the symbols are not in the arena
+    for(uint32_t id = 1; id < SYM_COUNT; id++) {
+        char *str = str_symbols[id].str;
+        assert(str_symbols[id].id == id);
+        intern_add(str, hash_range(str, strlen(str)));
+    }
+}
+
+// str_intern_len
+//
+// Returns the interned copy of the len characters starting at str (which are
+// not modified and need not be followed by a '\0')
+
+char *str_intern_len(const char *str, size_t len) {
+    if(str == NULL)
+        return NULL;
+
+    if(str_interned == NULL)
+        intern_init();
+
+    uint32_t hash = hash_range(str, len);
+    uint32_t pos = hash & (tableCapacity - 1);
+
+    for(uint32_t id; (id = table[pos]) != 0; pos = (pos + 1) & (tableCapacity - 1)) {
+        char *res = str_interned[id];
+        if(hashes[id] == hash && strncmp(res, str, len) == 0 && res[len] == '\0')
+            return res;
+    }
+
+    char *res = arena_add(str, len, internedNo);
+    intern_add(res, hash);
+    return res;
+}
+
+char *str_intern(char *str) {
+    return str != NULL ? str_intern_len(str, strlen(str)) : NULL;
+}
+
+char *str_intern_range(const char *start, const char *end) {
+    return str_intern_len(start, end - start);
+}
+
+void str_intern_cleanup() {
+    while(blocks != NULL) {
+        ARENA_BLOCK_T *next = blocks->next;
+        free(blocks);
+        blocks = next;
+    }
+    arenaNext = arenaEnd = NULL;
+
+    free(str_interned);
+    free(hashes);
+    free(table);
+    str_interned = NULL;
+    hashes = table = NULL;
+    internedNo = internedCapacity = tableCapacity = 0;
+}
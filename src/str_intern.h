@@ -1,8 +1,45 @@
-// Basic string interning utilities
-// Copyright Kostas Chatzikokolakis and Stefanos Baziotis
-
-#pragma once
-
-char *str_intern(char *str);
-char *str_intern_range(char *start, char *end);
-void str_intern_cleanup();
+// Basic string interning utilities
+// Copyright Kostas Chatzikokolakis and Stefanos Baziotis
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+char *str_intern(char *str);
+char *str_intern_len(const char *str, size_t len);
+char *str_intern_range(const char *start, const char *end);
+void str_intern_cleanup();
+
+// Every interned string has a 32-bit id (0 stands for NULL), stored just
+// before the string, so both conversions take constant time.
+
+extern char **str_interned;
+
+static inline uint32_t str_intern_id(char *interned) {
+    return interned ? ((uint32_t *)interned)[-1] : 0;
+}
+
+static inline char *str_intern_name(uint32_t id) {
+    return str_interned[id];
+}
+
+// Strings used by the interpreter itself. They are interned in advance with
+// these ids, str_symbol returns the interned string (even before anything
+// else is interned), so they are compared without looking them up.
+
+typedef enum {
+    SYM_ZERO = 1, SYM_SUCC, SYM_NIL, SYM_COLON, SYM_TILDE, SYM_TILDE_EQ, SYM_Y, SYM_ME,
+    SYM_COUNT
+} STR_SYMBOL;
+
+typedef struct {
+    uint32_t id;
+    char str[12];                   // right after the id, as in all interned strings
+} STR_SYMBOL_ENTRY;
+
+extern STR_SYMBOL_ENTRY str_symbols[SYM_COUNT];
+
+static inline char *str_symbol(STR_SYMBOL sym) {
+    return str_symbols[sym].str;
+}
@@ -0,0 +1,156 @@
+// vim:noet:ts=3
+
+// Hash tables with interned strings as keys
+// Copyright Kostas Chatzikokolakis
+//
+// The declarations and operators are looked up on every alias expansion and
+// while parsing every operator, so they are kept in tables specialized for
+// interned keys: a key is hashed by its id (see str_intern.h) and compared
+// as a pointer, and lookups (symtab.h) are inlined. The table uses open
+// addressing (linear probing) over an array of slots, which point to the
+// entries. The entries are kept in the order they were inserted, so iterating
+// over a table (eg. for ShowAlias) gives the same order in every run.
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include "symtab.h"
+
+
+#define SYMTAB_MIN_SHIFT	(32 - 6)			// 64 slots at first
+
+
+// Allocates the slots (1 << (32 - shift)) and places all entries which are not removed in them
+
+static void symtab_rehash(SymTab *table, int shift) {
+	uint32_t capacity = 1u << (32 - shift), mask = capacity - 1;
+
+	free(table->slots);
+	table->slots = calloc(capacity, sizeof(*table->slots));		// all SYMTAB_EMPTY
+	assert(table->slots);
+	table->shift = shift;
+
+	// removed entries are dropped, the order of the others is kept
+	int n = 0;
+	for(int pos = 0; pos < table->entryNo; pos++) {
+		if(table->entries[pos].id == NULL)
+			continue;
+
+		table->entries[n] = table->entries[pos];
+
+		uint32_t i = symtab_slot(table, table->entries[n].id);
+		while(table->slots[i] != SYMTAB_EMPTY)
+			i = (i + 1) & mask;
+		table->slots[i] = ++n;
+	}
+	table->entryNo = n;
+}
+
+SymTab *symtab_create(DestroyFunc destroy_value) {
+	SymTab *table = malloc(sizeof(SymTab));
+	assert(table);
+
+	table->slots = NULL;
+	table->entryNo = table->size = 0;
+	table->entryCapacity = (1 << (32 - SYMTAB_MIN_SHIFT)) / 2;
+	table->entries = malloc(table->entryCapacity * sizeof(*table->entries));
+	assert(table->entries);
+	table->destroy_value = destroy_value;
+
+	symtab_rehash(table, SYMTAB_MIN_SHIFT);
+	return table;
+}
+
+void symtab_destroy(SymTab *table) {
+	if(table->destroy_value != NULL)
+		for(int pos = symtab_first(table); pos != SYMTAB_EOF; pos = symtab_next(table, pos))
+			table->destroy_value(table->entries[pos].value);
+
+	free(table->slots);
+	free(table->entries);
+	free(table);
+}
+
+DestroyFunc symtab_set_destroy_value(SymTab *table, DestroyFunc destroy_value) {
+	DestroyFunc old = table->destroy_value;
+	table->destroy_value = destroy_value;
+	return old;
+}
+
+// symtab_insert
+//
+// Stores value with the given (interned) id. If id exists its value is
+// replaced (the old one is destroyed), and it keeps its position.
+
+void symtab_insert(SymTab *table, char *id, void *value) {
+	int pos = symtab_find_pos(table, id);
+	if(pos != SYMTAB_EOF) {
+		if(table->destroy_value != NULL && table->entries[pos].value != value)
+			table->destroy_value(table->entries[pos].value);
+		table->entries[pos].value = value;
+		return;
+	}
+
+	// the slots are at most half full (counting the removed entries, their slots are not reused)
+	if(table->entryNo == table->entryCapacity) {
+		if(table->size < table->entryCapacity / 2) {
+			symtab_rehash(table, table->shift);		// enough space after dropping the removed entries
+		} else {
+			table->entryCapacity *= 2;
+			table->entries = realloc(table->entries, table->entryCapacity * sizeof(*table->entries));
+			assert(table->entries);
+			symtab_rehash(table, table->shift - 1);
+		}
+	}
+
+	uint32_t mask = UINT32_MAX >> table->shift;
+	uint32_t i = symtab_slot(table, id);
+	while(table->slots[i] != SYMTAB_EMPTY)
+		i = (i + 1) & mask;
+
+	table->entries[table->entryNo] = (SYMTAB_ENTRY){ id, value };
+	table->slots[i] = ++table->entryNo;
+	table->size++;
+}
+
+// symtab_remove
+//
+// Removes id (destroying its value). Returns 1 if it existed.
+
+int symtab_remove(SymTab *table, char *id) {
+	int pos = symtab_find_pos(table, id);
+	if(pos == SYMTAB_EOF)
+		return 0;
+
+	if(table->destroy_value != NULL)
+		table->destroy_value(table->entries[pos].value);
+
+	// the slot stays occupied, so that probing continues past it
+	uint32_t mask = UINT32_MAX >> table->shift;
+	uint32_t i = symtab_slot(table, id);
+	while(table->slots[i] != (uint32_t)pos + 1)
+		i = (i + 1) & mask;
+	table->slots[i] = SYMTAB_REMOVED;
+
+	table->entries[pos].id = NULL;
+	table->size--;
+	return 1;
+}
+
+// symtab_first, symtab_next
+//
+// Iterate over the positions of the entries, in the order they were inserted:
+//   for(int pos = symtab_first(t); pos != SYMTAB_EOF; pos = symtab_next(t, pos))
+// While iterating, values can be replaced and entries removed, but inserting
+// a new id might move the entries.
+
+int symtab_first(SymTab *table) {
+	return symtab_next(table, -1);
+}
+
+int symtab_next(SymTab *table, int pos) {
+	for(pos++; pos < table->entryNo; pos++)
+		if(table->entries[pos].id != NULL)
+			return pos;
+	return SYMTAB_EOF;
+}
@@ -0,0 +1,86 @@
+// Declarations for symtab.c
+// Copyright Kostas Chatzikokolakis
+
+#pragma once
+
+#include <stdint.h>
+
+#include "ADTMap.h"
+#include "str_intern.h"
+
+
+// A hash table with interned strings as keys (see symtab.c). Keys are
+// compared as pointers and hashed by their id, lookups are inlined.
+
+typedef struct {
+	char *id;						// NULL if removed
+	void *value;
+} SYMTAB_ENTRY;
+
+typedef struct {
+	uint32_t *slots;				// position in entries + 1, or SYMTAB_EMPTY / SYMTAB_REMOVED
+	int shift;						// 32 - log2(number of slots)
+	SYMTAB_ENTRY *entries;			// in the order they were inserted
+	int entryNo, entryCapacity;		// entries used (including removed ones) and allocated
+	int size;						// entries not removed
+	DestroyFunc destroy_value;
+} SymTab;
+
+#define SYMTAB_EMPTY	0
+#define SYMTAB_REMOVED	UINT32_MAX
+#define SYMTAB_EOF		-1
+
+
+SymTab *symtab_create(DestroyFunc destroy_value);
+void symtab_destroy(SymTab *table);
+DestroyFunc symtab_set_destroy_value(SymTab *table, DestroyFunc destroy_value);
+
+void symtab_insert(SymTab *table, char *id, void *value);
+int symtab_remove(SymTab *table, char *id);
+
+int symtab_first(SymTab *table);
+int symtab_next(SymTab *table, int pos);
+
+
+// Returns the slot of id, starting from its hash (Fibonacci hashing of the id)
+
+static inline uint32_t symtab_slot(SymTab *table, char *id) {
+	return (str_intern_id(id) * 2654435769u) >> table->shift;
+}
+
+// symtab_find_pos
+//
+// Returns the position of id in the entries, or SYMTAB_EOF if it is not in the table
+
+static inline int symtab_find_pos(SymTab *table, char *id) {
+	uint32_t mask = UINT32_MAX >> table->shift;
+
+	for(uint32_t i = symtab_slot(table, id), slot; (slot = table->slots[i]) != SYMTAB_EMPTY; i = (i + 1) & mask)
+		if(slot != SYMTAB_REMOVED && table->entries[slot - 1].id == id)
+			return slot - 1;
+
+	return SYMTAB_EOF;
+}
+
+// symtab_find
+//
+// Returns the value stored with id, or NULL if there is none
+
+static inline void *symtab_find(SymTab *table, char *id) {
+	int pos = symtab_find_pos(table, id);
+	return pos != SYMTAB_EOF ? table->entries[pos].value : NULL;
+}
+
+// The id and value of the entry at position pos (see symtab_first)
+
+static inline char *symtab_id(SymTab *table, int pos) {
+	return table->entries[pos].id;
+}
+
+static inline void *symtab_value(SymTab *table, int pos) {
+	return table->entries[pos].value;
+}
+
+static inline int symtab_size(SymTab *table) {
+	return table->size;
+}
@@ -6,32 +6,280 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <time.h>
 #include <assert.h>
+#if __has_include(<sys/mman.h>)
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define HAVE_MMAP
+#endif
 
-#include "ADTVector.h"
+#include "ADTMap.h"
 
 #include "termproc.h"
 #include "decllist.h"
 #include "parser.h"
 #include "run.h"
 #include "str_intern.h"
+#include "symtab.h"
 
 
 static int termIsIdentity(TERM *t);
 static int termIsList(TERM *t);
 static void termPrintList(TERM *t);
 
-static int termIsFreeVar(TERM *t, char *name);
-static int termSubst(char *x, TERM *M, TERM *N, int mustClone);
-static int termAliasSubst(TERM *t);
-static char *getVariable(TERM *t1, TERM *t2);
+static int termIsFreeIndex(TERM *t, int index);
+static void termShift(TERM *t, int d, int cutoff);
+static int termSubst(TERM *M, TERM *N, int depth, int mustClone);
+static TERM *termClosure(TERM *M, TERM *cell, int depth, char *name);
+static TERM *cellNew(TERM *N);
+static TERM *cellTake(TERM *cell);
+static void cellRelease(TERM *cell);
+static void termSubstHead(TERM *t);
+static void termForce(TERM *t);
+static int termAliasSubst(TERM *t, int lifted);
+static TERM *termCopy(TERM *t, int share);
+static int termInstantiate(TERM *t);
+static char *getVariable(TERM *t);
+static char *variableName(int n);
+static void termFreeSubterms(TERM *t);
+
+
+// Terms are allocated in chunks, unused ones are kept in a free list linked
+// through their name (which a freed term does not need). Chunks are kept
+// between executions and released only by termFreeAll.
+#define CHUNK_TERMS	(1 << 14)
+
+#define BUFFER_RETAIN	(1 << 16)		// buffers up to this many entries are kept between executions
+
+// percentage of scattered terms which triggers termCompact, can be set when compiling
+#ifndef COMPACT_SCATTERED
+#define COMPACT_SCATTERED	50
+#endif
+
+#ifdef COMPACT_TERMS
+
+// All terms are in termNodes, which is reserved at once (only the pages in use
+// take memory) and never moves. Chunks are taken from it in order, term 0 is
+// not used (it stands for NULL).
+#define MAX_TERMS	(1u << 28)
+
+TERM *termNodes = NULL;
+static TERM_REF termTop = 0;
+static TERM_REF *spareChunks = NULL;	// chunks released by termTrim, reused before the ones after termTop
+static int spareChunkNo = 0;
+
+#define NEXT_FREE(t)		termPtr((t)->nameId)
+#define SET_NEXT_FREE(t, n)	((t)->nameId = termRef(n))
+
+#else
+
+typedef struct term_chunk {
+	struct term_chunk *next;
+	TERM terms[CHUNK_TERMS];
+} TERM_CHUNK;
+
+static TERM_CHUNK *chunks = NULL;
+
+#define NEXT_FREE(t)		((TERM *)(t)->name)
+#define SET_NEXT_FREE(t, n)	((t)->name = (char *)(n))
+
+#endif
+
+#ifdef HAVE_MMAP
 
+// With termSetFile the chunks are taken from a file mapped in memory, which
+// is extended by SEGMENT_SIZE bytes at a time
+#define SEGMENT_SIZE	(64 << 20)
 
-static Vector termPool = NULL;
+static int termsFile = -1;				// the file, or -1 if the chunks are in memory
+static off_t termsFileSize = 0;
+
+static void termsFileExtend(off_t size);
+
+#ifndef COMPACT_TERMS
+static char *segmentNext = NULL;		// the unused part of the last segment
+static char *segmentEnd = NULL;
+static char **segments = NULL;			// all mapped segments
+static int segmentNo = 0;
+#endif
+
+#endif
+
+static TERM *freeTerms = NULL;
+static TERM *sharedTerms = NULL;		// released shared terms, reused only as shared ones (see termThaw)
+static Map consTerms = NULL;			// hash-consed shared terms, each one is its own key (see termFreeze)
+static int chunkNo = 0;
+static int termsUsed = 0, termsPeak = 0;		// terms not in the free list, and their maximum
+static int poolMark = 0;				// terms needed by recent executions (see termGC)
+static int trimChunks = 0;				// chunks left by the last termTrim
+static unsigned long poolHits = 0;		// terms taken from the free list, and chunks allocated
+static unsigned long poolMisses = 0;	// because it was empty
+static int compactNo = 0;				// compactions since the last termGC, and their time
+static clock_t compactTime = 0;
 static TERM **_termStack = NULL;
 static TERM **_termStackNext = NULL;	// points to first empty slot
 static int _termStackCapacity = 0;
 
+// set by termSubst when N itself (not a clone) is placed in M, at the given depth
+// (further occurrences are clones of substPlaced)
+static TERM *substPlaced;
+static int substDepth;
+
+// used by termInstantiate: the applications of the instantiated alias (the
+// outermost first), and for each argument the term placed in the body and its depth
+static TERM **instSpine = NULL;
+static int instSpineCapacity = 0;
+static TERM **instArgs = NULL, **instPlaced = NULL;
+static int *instDepth = NULL;
+static int instArgCapacity = 0;
+
+// the search of termConv for the next redex: the terms from the root to the
+// one where the search continues, and the way the search went in each of them
+typedef enum {
+	SPINE_LEFT,			// application, in the left subterm (the right one is searched later)
+	SPINE_RIGHT,		// application, in the right subterm
+	SPINE_BODY,			// abstraction
+	SPINE_TILDE,		// ~ application of an abstraction, in the argument (reduced first)
+} SPINE_DIR;
+
+typedef struct {
+	TERM *term;
+	SPINE_DIR dir;
+} SPINE_ENTRY;
+
+typedef struct {
+	TERM *root;					// the term being reduced, NULL if there is no search to resume
+	TERM *next;					// where the search continues (or the last reduction, if 'reduced' is set)
+	int reduced;
+	SPINE_ENTRY *spine;			// the terms above next, the root first
+	int spineNo, spineCapacity;
+	int *etas;					// positions in spine of abstractions \x.M x with next inside M
+	int etaNo, etaCapacity;
+} CONV_SEARCH;
+
+static CONV_SEARCH convSearch;
+static int convBusy = 0;		// set while termConv runs
+
+// names of the enclosing abstractions while printing, the innermost is the last one
+static char **printNames = NULL;
+static int printNameNo = 0, printNameCapacity = 0;
+static SymTab *usedNames = NULL;		// filled by termUsesName, while getVariable runs
+
+
+// Names of bound variables
+//
+// Terms are stored without names for bound variables (see parser.h), names are
+// restored during printing. The name of an abstraction is kept unless it would
+// capture some variable inside its body which refers to something outside
+// (a free variable or an enclosing abstraction) with the same name, eg
+// (\x.\y.y x) y  ->  \a.a y  (bound y renamed to a)
+
+static void pushPrintName(char *name) {
+	if(printNameNo == printNameCapacity) {
+		printNameCapacity = printNameCapacity ? 2*printNameCapacity : 100;
+		printNames = realloc(printNames, printNameCapacity * sizeof(*printNames));
+		assert(printNames);
+	}
+	printNames[printNameNo++] = name;
+}
+
+// The body M of a closure M[x:=N] is printed with x in the position of
+// the variable with index depth, so the innermost depth names are pushed
+// again after x. N is printed without the innermost depth names (they are
+// restored by showPrintNames).
+
+static void enterClosure(TERM *t, char *name) {
+	int start = printNameNo - t->depth;
+
+	pushPrintName(name);
+	for(int i = 0; i < t->depth; i++)
+		pushPrintName(printNames[start + i]);
+}
+
+static char **hidePrintNames(int n) {
+	char **hidden = malloc((n + 1) * sizeof(*hidden));
+	assert(hidden);
+
+	printNameNo -= n;
+	for(int i = 0; i < n; i++)
+		hidden[i] = printNames[printNameNo + i];
+	return hidden;
+}
+
+static void showPrintNames(char **hidden, int n) {
+	for(int i = 0; i < n; i++)
+		pushPrintName(hidden[i]);
+	free(hidden);
+}
+
+// Returns 1 if t contains a variable with the given name, which is bound
+// outside t. depth is the number of abstractions between t and the abstraction
+// being named (whose variable has index depth), or -1 if t itself is being
+// named. If name is NULL, the names of all such variables are added to
+// usedNames (and 0 is returned).
+
+static int termUsesName(TERM *t, char *name, int depth) {
+	// closed terms don't use anything outside them
+	if(t->closed)
+		return 0;
+
+	switch(t->type) {
+	 case TM_VAR: {
+		char *used = t->index < 0
+			? NAME(t)
+			: t->index > depth && t->index - depth <= printNameNo
+			? printNames[printNameNo - (t->index - depth)]
+			: NULL;
+
+		if(name == NULL && used != NULL)
+			symtab_insert(usedNames, used, used);
+		return name != NULL && used == name;
+	 }
+
+	 case TM_ABSTR:
+		return termUsesName(RTERM(t), name, depth + 1);
+
+	 case TM_APPL:
+		return termUsesName(LTERM(t), name, depth) ||
+			termUsesName(RTERM(t), name, depth);
+
+	 case TM_SUBST: {
+		// the abstractions up to the one being named are pushed as NULL names (which
+		// match nothing), then M and N are checked with the names used for printing
+		int res;
+		for(int i = 0; i <= depth; i++)
+			pushPrintName(NULL);
+
+		enterClosure(t, NULL);
+		res = termUsesName(LTERM(t), name, -1);
+		printNameNo -= t->depth + 1;
+
+		if(!res) {
+			char **hidden = hidePrintNames(t->depth);
+			res = termUsesName(RTERM(RTERM(t)), name, -1);
+			showPrintNames(hidden, t->depth);
+		}
+
+		printNameNo -= depth + 1;
+		return res;
+	 }
+
+	 default:
+		return 0;
+	}
+}
+
+// Returns the name under which abstraction (or closure) t will be printed
+
+static char *termAbstrName(TERM *t) {
+	return termUsesName(t, NAME(t), -1)
+		? getVariable(t)
+		: NAME(t);
+}
+
 
 // termPrint
 //
@@ -57,8 +305,14 @@ void termPrint(TERM *t, int isMostRight) {
 
 	switch(t->type) {
 	 case TM_VAR:
+		// bound variables take the name of their abstraction
+		printf("%s", t->index >= 0 && t->index < printNameNo
+			? printNames[printNameNo - 1 - t->index]
+			: NAME(t));
+		break;
+
 	 case TM_ALIAS:
-		printf("%s", t->name);
+		printf("%s", NAME(t));
 		break;
 
 	 case TM_ABSTR:
@@ -67,9 +321,13 @@ void termPrint(TERM *t, int isMostRight) {
 		else {
 			if(showPar || !isMostRight) printf("(");
 
+			char *name = termAbstrName(t);
 			printf(greekLambda ? "\u03BB" : "\\");
-			printf("%s.", t->name);
-			termPrint(t->rterm, 1);
+			printf("%s.", name);
+
+			pushPrintName(name);
+			termPrint(RTERM(t), 1);
+			printNameNo--;
 
 			if(showPar || !isMostRight) printf(")");
 		}
@@ -78,19 +336,40 @@ void termPrint(TERM *t, int isMostRight) {
 	 case TM_APPL:
 		if(showPar) printf("(");
 
-		termPrint(t->lterm, 0);
+		termPrint(LTERM(t), 0);
 
-		if(t->name)
-			printf(" %s ", t->name);
+		if(NAME(t))
+			printf(" %s ", NAME(t));
 		else
 			printf(" ");
 
-		if(!showPar && t->rterm->type == TM_APPL) printf("(");
-		termPrint(t->rterm, isMostRight);
-		if(!showPar && t->rterm->type == TM_APPL) printf(")");
+		if(!showPar && RTERM(t)->type == TM_APPL) printf("(");
+		termPrint(RTERM(t), isMostRight);
+		if(!showPar && RTERM(t)->type == TM_APPL) printf(")");
 
 		if(showPar) printf(")");
 		break;
+
+	 case TM_SUBST: {
+		// closure, printed as M[x:=N]
+		char *name = termAbstrName(t);
+
+		enterClosure(t, name);
+		if(LTERM(t)->type == TM_APPL) {
+			printf("(");
+			termPrint(LTERM(t), 1);
+			printf(")");
+		} else
+			termPrint(LTERM(t), 0);
+		printNameNo -= t->depth + 1;
+
+		printf("[%s:=", name);
+		char **hidden = hidePrintNames(t->depth);
+		termPrint(RTERM(RTERM(t)), 1);
+		showPrintNames(hidden, t->depth);
+		printf("]");
+		break;
+	 }
 	}
 }
 
@@ -128,56 +407,548 @@ static inline int termStackSize() {
 }
 
 void termFree(TERM *t) {
-	// if NULL do nothing
-	if(!t) return;
+	// if NULL do nothing, shared terms are released only by termThaw
+	if(!t || t->shared) return;
 
-	if(termPool == NULL)
-		termPool = vector_create(0, NULL);
-
-	// put the term in the pool, but dont recurse to subterms, they
+	// put the term in the free list, but dont recurse to subterms, they
 	// will be freed when the term is used (this seems to be faster).
-	vector_insert_last(termPool, t);
+	SET_NEXT_FREE(t, freeTerms);
+	freeTerms = t;
+	termsUsed--;
 }
 
-void termGC() {
-	if(termPool != NULL) {
-		while(vector_size(termPool) > 0)
-			free(termNew());
+// Releases the buffers used by the term functions which have more than
+// 'retain' entries, the others are kept for the next execution
 
-		vector_destroy(termPool);
-		termPool = NULL;
-	}
-
-	if(_termStack != NULL) {
+static void releaseBuffers(int retain) {
+	if(_termStackCapacity > retain) {
 		free(_termStack);
 		_termStack = _termStackNext = NULL;
 		_termStackCapacity = 0;
 	}
+
+	if(printNameCapacity > retain) {
+		free(printNames);
+		printNames = NULL;
+		printNameNo = printNameCapacity = 0;
+	}
+
+	if(instSpineCapacity > retain) {
+		free(instSpine);
+		instSpine = NULL;
+		instSpineCapacity = 0;
+	}
+
+	if(instArgCapacity > retain) {
+		free(instArgs);
+		free(instPlaced);
+		free(instDepth);
+		instArgs = instPlaced = NULL;
+		instDepth = NULL;
+		instArgCapacity = 0;
+	}
+
+	if(convSearch.spineCapacity > retain || convSearch.etaCapacity > retain) {
+		free(convSearch.spine);
+		free(convSearch.etas);
+		convSearch = (CONV_SEARCH){ 0 };
+	}
 }
 
-TERM *termNew() {
-	if(termPool == NULL)
-		termPool = vector_create(0, NULL);
+// termGC
+//
+// Called after each execution. The chunks of terms and the buffers used by
+// the term functions are kept for the next execution, so that it does not
+// allocate them again, unless they are much larger than what executions use
+// lately (see termTrim).
 
-	int size = vector_size(termPool);
-	if(size > 0) {
-		TERM* t = vector_get_at(termPool, size-1);
-		vector_remove_last(termPool);
+void termGC() {
+	// the mark follows the peaks, and decreases slowly when executions need less terms
+	poolMark = termsPeak > poolMark ? termsPeak : poolMark - poolMark / 8;
+	if(chunkNo > trimChunks && chunkNo * CHUNK_TERMS > 2 * poolMark + CHUNK_TERMS)
+		termTrim(poolMark);
 
-		// free subterm (they are not freed when the term is freed)
-		if(t->type == TM_APPL) {
-			termFree(t->lterm);
-			termFree(t->rterm);
-		} else if(t->type == TM_ABSTR) {
-			termFree(t->rterm);
+	termsPeak = termsUsed;
+	compactNo = 0;
+	compactTime = 0;
+
+	releaseBuffers(BUFFER_RETAIN);
+}
+
+// termFreeAll
+//
+// Releases all chunks at once, every existing term becomes invalid (used
+// before exiting).
+
+void termFreeAll() {
+	termGC();
+	releaseBuffers(0);
+
+#ifdef COMPACT_TERMS
+	if(termNodes != NULL) {
+		munmap(termNodes, MAX_TERMS * sizeof(TERM));
+		termNodes = NULL;
+		termTop = 0;
+	}
+#else
+#ifdef HAVE_MMAP
+	if(termsFile != -1) {
+		// the chunks are in the segments
+		for(int i = 0; i < segmentNo; i++)
+			munmap(segments[i], SEGMENT_SIZE);
+		free(segments);
+		segments = NULL;
+		segmentNo = 0;
+		segmentNext = segmentEnd = NULL;
+		chunks = NULL;
+	}
+#endif
+	while(chunks) {
+		TERM_CHUNK *next = chunks->next;
+		free(chunks);
+		chunks = next;
+	}
+#endif
+#ifdef HAVE_MMAP
+	if(termsFile != -1)
+		termsFileExtend(-termsFileSize);
+#endif
+	if(consTerms != NULL) {
+		map_destroy(consTerms);
+		consTerms = NULL;
+	}
+#ifdef COMPACT_TERMS
+	free(spareChunks);
+	spareChunks = NULL;
+	spareChunkNo = 0;
+#endif
+	freeTerms = sharedTerms = NULL;
+	chunkNo = termsUsed = termsPeak = poolMark = trimChunks = 0;
+}
+
+// termStats
+//
+// Returns the number of allocated chunks of terms, and the maximum number of
+// terms used since the last termGC. Terms whose subterms are freed lazily
+// (see termFree) count as used until the term is reused.
+
+void termStats(int *chunkCount, int *peak) {
+	*chunkCount = chunkNo;
+	*peak = termsPeak;
+}
+
+// termCompactStats
+//
+// Returns the number of compactions (see termCompact) since the last termGC,
+// and the time spent in termCompact in seconds
+
+void termCompactStats(int *count, double *seconds) {
+	*count = compactNo;
+	*seconds = (double)compactTime / CLOCKS_PER_SEC;
+}
+
+// Compaction
+//
+// Terms taken from the free list after many reductions are scattered over the
+// chunks, so termConv, which visits a term depth-first (a term, then its left
+// and right subterm), keeps missing the cache. termCompact moves the term to
+// consecutive terms in this order. Shared terms and the cells of closures are
+// used by other terms too, they are not moved.
+
+// Visits the movable subterms of t (but not t itself) in depth-first order.
+// If move = 1 each one is moved to a new term, otherwise nothing is changed.
+// Returns the number of subterms visited, and in *scattered the number of
+// those which are not right after the previous one.
+
+static int compactWalk(TERM *t, int move, int *scattered) {
+	int base = termStackSize(), count = 0;
+	TERM *prev = t, *moved = NULL;		// moved: the old terms, freed at the end
+
+	*scattered = 0;
+
+	TERM *p = t;							// the next subterm to visit is the left (or right) one of p
+	int left;
+	switch(t->type) {
+	 case TM_APPL:
+		termPush(t);						// the right subterm is visited later
+		// fall through
+	 case TM_SUBST:
+		left = 1;
+		break;
+	 case TM_ABSTR:
+		left = 0;
+		break;
+	 default:
+		return 0;
+	}
+
+	for(;;) {
+		TERM *c = left ? LTERM(p) : RTERM(p);
+
+		if(c != NULL && !c->shared) {
+			count++;
+			if(c != prev + 1)
+				(*scattered)++;
+
+			if(move) {
+				// moved terms are freed at the end, so that they are not reused while moving
+				TERM *n = termNew();
+				*n = *c;
+				if(left)
+					SET_LTERM(p, n);
+				else
+					SET_RTERM(p, n);
+
+				c->type = TM_VAR;			// the subterms now belong to n
+				SET_NEXT_FREE(c, moved);
+				moved = c;
+				c = n;
+			}
+			prev = c;
+
+			switch(c->type) {
+			 case TM_APPL:
+				termPush(c);
+				// fall through
+			 case TM_SUBST:					// the cell is not moved
+				p = c;
+				left = 1;
+				continue;
+			 case TM_ABSTR:
+				p = c;
+				left = 0;
+				continue;
+			 default:
+				break;
+			}
 		}
-		return t;
 
-	} else {
-		TERM* res = malloc(sizeof(TERM));
-		assert(res);
-		return res;
+		if(termStackSize() == base)
+			break;
+		p = termPop();
+		left = 0;
+	}
+
+	while(moved != NULL) {
+		TERM *next = NEXT_FREE(moved);
+		termFree(moved);
+		moved = next;
+	}
+
+	return count;
+}
+
+static int compareAddresses(const void *a, const void *b) {
+	TERM *s = *(TERM **)a, *t = *(TERM **)b;
+	return (s > t) - (s < t);
+}
+
+// Empties the free list and returns its terms sorted by address (count is
+// set to their number). The subterms of freed terms are freed first, so that
+// the terms can be used in any order.
+
+static TERM **takeFreeTerms(int *count) {
+	int capacity = 1024;
+	*count = 0;
+	TERM **terms = malloc(capacity * sizeof(*terms));
+	assert(terms);
+
+	while(freeTerms != NULL) {
+		TERM *t = freeTerms;
+		freeTerms = NEXT_FREE(t);
+		termFreeSubterms(t);				// might add terms to freeTerms
+
+		if(*count == capacity) {
+			capacity *= 2;
+			terms = realloc(terms, capacity * sizeof(*terms));
+			assert(terms);
+		}
+		terms[(*count)++] = t;
+	}
+
+	qsort(terms, *count, sizeof(*terms), compareAddresses);
+	return terms;
+}
+
+// Puts back in the free list the terms returned by takeFreeTerms (except
+// those set to NULL), in the same order, and frees the array
+
+static void putFreeTerms(TERM **terms, int count) {
+	for(int i = count - 1; i >= 0; i--) {
+		if(terms[i] != NULL) {
+			SET_NEXT_FREE(terms[i], freeTerms);
+			freeTerms = terms[i];
+		}
+	}
+	free(terms);
+}
+
+// Sorts the free list by address, so that the terms taken from it are
+// consecutive as far as possible (termNew will not add the subterms of
+// freed terms to it as it goes)
+
+static void sortFreeTerms() {
+	int count;
+	TERM **terms = takeFreeTerms(&count);
+	putFreeTerms(terms, count);
+}
+
+// Returns the position of the terms of the chunk starting at 'start' in the
+// sorted free terms, or -1 if some of them are not free
+
+static int chunkFreePosition(TERM **terms, int count, TERM *start) {
+	int low = 0, high = count;
+	while(low < high) {
+		int mid = (low + high) / 2;
+		if(terms[mid] < start)
+			low = mid + 1;
+		else
+			high = mid;
 	}
+
+	return low + CHUNK_TERMS <= count && terms[low + CHUNK_TERMS - 1] == start + CHUNK_TERMS - 1
+		? low
+		: -1;
+}
+
+// termTrim
+//
+// Releases the chunks whose terms are all free, as long as the remaining
+// chunks have at least 'keep' terms. Returns the number of chunks released.
+// Called by termGC when the chunks are much more than recent executions need,
+// and by the Trim command.
+
+int termTrim(int keep) {
+#if defined(HAVE_MMAP) && !defined(COMPACT_TERMS)
+	if(termsFile != -1) {
+		trimChunks = chunkNo;				// the segments of the file are released only together
+		return 0;
+	}
+#endif
+
+	int count, released = 0;
+	TERM **terms = takeFreeTerms(&count);
+	int *positions = malloc((chunkNo + 1) * sizeof(*positions));		// of the terms of the released chunks
+	assert(positions);
+
+#ifdef COMPACT_TERMS
+	for(TERM_REF ref = 1; ref < termTop && (chunkNo - 1) * CHUNK_TERMS >= keep; ref += CHUNK_TERMS) {
+		int pos = chunkFreePosition(terms, count, termNodes + ref);
+		if(pos == -1)
+			continue;
+
+		// the memory is returned to the system, the range is reused by chunkNew
+		madvise(termNodes + ref, CHUNK_TERMS * sizeof(TERM), MADV_DONTNEED);
+		spareChunks = realloc(spareChunks, (spareChunkNo + 1) * sizeof(*spareChunks));
+		assert(spareChunks);
+		spareChunks[spareChunkNo++] = ref;
+
+		positions[released++] = pos;
+		chunkNo--;
+	}
+#else
+	for(TERM_CHUNK **chunk = &chunks; *chunk != NULL && (chunkNo - 1) * CHUNK_TERMS >= keep; ) {
+		int pos = chunkFreePosition(terms, count, (*chunk)->terms);
+		if(pos == -1) {
+			chunk = &(*chunk)->next;
+			continue;
+		}
+
+		TERM_CHUNK *next = (*chunk)->next;
+		free(*chunk);
+		*chunk = next;
+
+		positions[released++] = pos;
+		chunkNo--;
+	}
+#endif
+
+	// the terms of the released chunks are removed from the free list
+	for(int i = 0; i < released; i++)
+		for(int j = 0; j < CHUNK_TERMS; j++)
+			terms[positions[i] + j] = NULL;
+	free(positions);
+	putFreeTerms(terms, count);
+
+	trimChunks = chunkNo;
+	return released;
+}
+
+// termPoolStats
+//
+// Returns the number of terms taken from the free list, and of the times it
+// was empty and a new chunk was needed, since the program started
+
+void termPoolStats(unsigned long *hits, unsigned long *misses) {
+	*hits = poolHits;
+	*misses = poolMisses;
+}
+
+// termCompact
+//
+// Moves the subterms of t (t itself stays in place) to consecutive terms in
+// the order termConv visits them, if more than COMPACT_SCATTERED percent of
+// them are scattered. Returns 1 if t was compacted. Called by execTerm every
+// COMPACT_INTERVAL reductions.
+
+int termCompact(TERM *t) {
+	clock_t start = clock();
+	int scattered, count = compactWalk(t, 0, &scattered);
+
+	int compact = scattered * 100 > count * COMPACT_SCATTERED;
+	if(compact) {
+		sortFreeTerms();
+		compactWalk(t, 1, &scattered);
+		compactNo++;
+		termConvReset();			// the terms of its search have moved
+	}
+
+	compactTime += clock() - start;
+	return compact;
+}
+
+// Returns CHUNK_TERMS new terms
+
+#ifdef HAVE_MMAP
+
+// termSetFile
+//
+// Keeps the terms in the given file, mapped in memory, instead of the main
+// memory, so that terms larger than the memory can be reduced (slowly, the
+// system writes to the file the parts not in use). The file must not exist,
+// it is removed at once and takes space only while the program runs. Must be
+// called before any term is created. Returns 0 on success, -1 if the file
+// cannot be created.
+
+int termSetFile(char *path) {
+	assert(chunkNo == 0);
+
+	int fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if(fd == -1)
+		return -1;
+
+	unlink(path);
+	termsFile = fd;
+	return 0;
+}
+
+// Changes the size of the terms file by size bytes
+
+static void termsFileExtend(off_t size) {
+	if(ftruncate(termsFile, termsFileSize + size) != 0) {
+		fprintf(stderr, "Error: cannot extend the terms file\n");
+		abort();
+	}
+	termsFileSize += size;
+}
+
+#ifndef COMPACT_TERMS
+
+// Returns a chunk from the mapped segments of the terms file
+
+static TERM_CHUNK *chunkFromFile() {
+	if(segmentEnd - segmentNext < sizeof(TERM_CHUNK)) {
+		char *segment = mmap(NULL, SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, termsFile, termsFileSize);
+		assert(segment != MAP_FAILED);
+		termsFileExtend(SEGMENT_SIZE);
+
+		segments = realloc(segments, (segmentNo + 1) * sizeof(*segments));
+		assert(segments);
+		segments[segmentNo++] = segment;
+
+		segmentNext = segment;
+		segmentEnd = segment + SEGMENT_SIZE;
+	}
+
+	TERM_CHUNK *chunk = (TERM_CHUNK *)segmentNext;
+	segmentNext += sizeof(TERM_CHUNK);
+	return chunk;
+}
+
+#endif
+#else
+
+int termSetFile(char *path) {
+	return -1;
+}
+
+#endif
+
+static TERM *chunkNew() {
+	chunkNo++;
+
+#ifdef COMPACT_TERMS
+	if(termNodes == NULL) {
+		// with a terms file, all of it is mapped, and it is extended as chunks are taken
+		termNodes = termsFile != -1
+			? mmap(NULL, MAX_TERMS * sizeof(TERM), PROT_READ | PROT_WRITE, MAP_SHARED, termsFile, 0)
+			: mmap(NULL, MAX_TERMS * sizeof(TERM), PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		assert(termNodes != MAP_FAILED);
+		termTop = 1;
+	}
+	if(spareChunkNo > 0)
+		return termNodes + spareChunks[--spareChunkNo];
+
+	assert(termTop <= MAX_TERMS - CHUNK_TERMS);
+
+	if(termsFile != -1 && (termTop + CHUNK_TERMS) * sizeof(TERM) > termsFileSize)
+		termsFileExtend(SEGMENT_SIZE);
+
+	TERM *terms = termNodes + termTop;
+	termTop += CHUNK_TERMS;
+	return terms;
+#else
+#ifdef HAVE_MMAP
+	TERM_CHUNK *chunk = termsFile != -1 ? chunkFromFile() : malloc(sizeof(TERM_CHUNK));
+#else
+	TERM_CHUNK *chunk = malloc(sizeof(TERM_CHUNK));
+#endif
+	assert(chunk);
+	chunk->next = chunks;
+	chunks = chunk;
+	return chunk->terms;
+#endif
+}
+
+TERM *termNew() {
+	if(freeTerms == NULL) {
+		poolMisses++;
+		TERM *terms = chunkNew();
+
+		for(int i = CHUNK_TERMS-1; i >= 0; i--) {
+			terms[i].type = TM_VAR;			// no subterms to free
+			terms[i].shared = 0;
+			SET_NEXT_FREE(&terms[i], freeTerms);
+			freeTerms = &terms[i];
+		}
+	} else
+		poolHits++;
+
+	TERM *t = freeTerms;
+	freeTerms = NEXT_FREE(t);
+	if(++termsUsed > termsPeak)
+		termsPeak = termsUsed;
+
+	termFreeSubterms(t);
+	t->normal = 0;
+	FREE_MASK(t) = FREE_ALL;		// until it is computed
+	return t;
+}
+
+// Frees the subterms of a freed term (they are not freed when the term is freed)
+
+static void termFreeSubterms(TERM *t) {
+	if(t->type == TM_APPL || (t->type == TM_SUBST && LTERM(t) == NULL)) {
+		termFree(LTERM(t));
+		termFree(RTERM(t));
+	} else if(t->type == TM_SUBST) {
+		termFree(LTERM(t));
+		cellRelease(RTERM(t));
+	} else if(t->type == TM_ABSTR) {
+		termFree(RTERM(t));
+	}
+	t->type = TM_VAR;					// no subterms to free
 }
 
 // termClone
@@ -185,6 +956,19 @@ TERM *termNew() {
 // Creates and returns a clone of a term (and all its subterms).
 
 TERM *termClone(TERM *t) {
+	return termCopy(t, 0);
+}
+
+// termShare
+//
+// Like termClone, but shared subterms are not copied (see termFreeze), if t
+// itself is shared it is returned as it is.
+
+static TERM *termShare(TERM *t) {
+	return t->shared ? t : termCopy(t, 1);
+}
+
+static TERM *termCopy(TERM *t, int share) {
 	// To avoid recursion, we push in the stack pairs of (<new-empty-term-to-be-filled>, <term>)
 	// Note: use the stack only when we need to add a second item to process
 	//
@@ -201,47 +985,308 @@ TERM *termClone(TERM *t) {
 
 		newTerm->type = t->type;
 		newTerm->closed = t->closed;
-		newTerm->name = t->name;			// fast copy, strings are interned
+		newTerm->normal = t->normal;
+		COPY_NAME(newTerm, t);			// fast copy, strings are interned
+		newTerm->index = t->index;
+		newTerm->depth = t->depth;
 
-		if(t->type == TM_APPL) {
-			assert(t->lterm && t->rterm);
+		TERM *next = NULL;				// the subterm processed next (without using the stack)
 
-			newTerm->lterm = termNew();
-			newTerm->rterm = termNew();
+		if(t->type == TM_SUBST) {
+			// the clone of a closure uses the same cell
+			SET_RTERM(newTerm, RTERM(t));
+			RTERM(newTerm)->index++;
 
-			// 2 more pairs to process, push the one and put the other in (t,newTerm)
-			termPush(newTerm->lterm);
-			termPush(t->lterm);
+			next = LTERM(t);
 
-			newTerm = newTerm->rterm;
-			t = t->rterm;
+		} else if(t->type == TM_APPL) {
+			assert(LTERM(t) && RTERM(t));
 
-			todo += 2;
+			// 2 more pairs to process, push the one and put the other in (t,newTerm)
+			if(share && LTERM(t)->shared) {
+				SET_LTERM(newTerm, LTERM(t));
+			} else {
+				SET_LTERM(newTerm, termNew());
+				termPush(LTERM(newTerm));
+				termPush(LTERM(t));
+				todo++;
+			}
+			next = RTERM(t);
 
 		} else if(t->type == TM_ABSTR) {
-			assert(t->rterm);
-
-			newTerm->rterm = termNew();
+			assert(RTERM(t));
+			next = RTERM(t);
+		}
 
-			// put the new pair to process in (t,newTerm)
-			newTerm = newTerm->rterm;
-			t = t->rterm;
+		if(next == NULL) {
+			t = NULL;
+			continue;
+		}
 
-			todo ++;
+		// put the new pair to process in (t,newTerm), shared subterms are used as they are
+		TERM *copy = share && next->shared ? next : termNew();
+		if(t->type == TM_SUBST)
+			SET_LTERM(newTerm, copy);
+		else
+			SET_RTERM(newTerm, copy);
 
-		} else {
+		if(copy == next) {
 			t = NULL;
+		} else {
+			newTerm = copy;
+			t = next;
+			todo++;
 		}
 	}
 
 	return res;
 }
 
+// Shared terms
+//
+// Expanding an alias used to clone the whole declaration, although reductions
+// often use only part of it (the rest is discarded, eg. the branch of an If
+// which is not taken). So the lifted declarations are frozen (termFreeze), and
+// their terms are marked as shared. Shared terms are never modified or freed
+// by the term functions. Alias expansions place them in the executed term as
+// they are, and a shared term is copied (termUnshare) only when termConv is
+// about to modify it, so only the parts of a declaration reached by the
+// reductions are ever copied.
+
+// termUnshare
+//
+// Returns t if it is not shared, otherwise a copy of it which can be modified
+// (its subterms are the same, shared ones)
+
+static inline TERM *termUnshare(TERM *t) {
+	if(!t->shared)
+		return t;
+
+	TERM *copy = termNew();
+	*copy = *t;
+	copy->shared = 0;
+	return copy;
+}
+
+// Return the left (right) subterm of t (which must not be shared), replacing
+// it with termUnshare first
+
+static inline TERM *termOwnL(TERM *t) {
+	TERM *l = LTERM(t);
+	if(l->shared)
+		SET_LTERM(t, l = termUnshare(l));
+	return l;
+}
+
+static inline TERM *termOwnR(TERM *t) {
+	TERM *r = RTERM(t);
+	if(r->shared)
+		SET_RTERM(t, r = termUnshare(r));
+	return r;
+}
+
+// termMove
+//
+// Moves the contents of src (but not its subterms) to dst, then frees src
+// unless it is shared
+
+static void termMove(TERM *dst, TERM *src) {
+	*dst = *src;
+	dst->shared = 0;
+
+	if(!src->shared) {
+		SET_LTERM(src, NULL); SET_RTERM(src, NULL);
+		termFree(src);
+	}
+}
+
+// Hash-consing
+//
+// With the hashcons option, identical closed subterms of the frozen
+// declarations (eg. numerals or True/False) are stored once. A frozen term is
+// built bottom-up, so its subterms are already consed and two terms are
+// identical iff they have the same fields and the same subterms (as pointers).
+// Bound variables are identified by their index, so the names of abstractions
+// and bound variables are ignored (they are only hints for printing) and
+// alpha-equivalent terms are identical.
+
+// Returns the name of t which is compared when consing
+
+static inline char *consName(TERM *t) {
+	return t->type == TM_ABSTR || (t->type == TM_VAR && t->index >= 0)
+		? NULL
+		: NAME(t);
+}
+
+static uint consHash(Pointer p) {
+	TERM *t = p;
+	uintptr_t h = t->type;
+	h = h * 31 + (uint)t->index;
+	h = h * 31 + (uintptr_t)consName(t);
+	h = h * 31 + (uintptr_t)LTERM(t);
+	h = h * 31 + (uintptr_t)RTERM(t);
+	return h ^ (h >> 17);
+}
+
+static int consCompare(Pointer a, Pointer b) {
+	TERM *s = a, *t = b;
+	return !(s->type == t->type && s->index == t->index && s->depth == t->depth && s->closed == t->closed
+		&& consName(s) == consName(t) && LTERM(s) == LTERM(t) && RTERM(s) == RTERM(t));
+}
+
+// Returns 1 if t is the consed copy of itself, so it is released only by termConsClear
+
+static int termIsConsed(TERM *t) {
+	return consTerms != NULL && map_find(consTerms, t) == t;
+}
+
+// Returns a shared copy of t, consed if cons = 1
+
+static TERM *freezeCopy(TERM *t, int cons) {
+	assert(t->type != TM_SUBST);			// closures only exist during execution
+
+	TERM *s;
+	if(sharedTerms != NULL) {
+		s = sharedTerms;
+		sharedTerms = NEXT_FREE(s);
+	} else {
+		s = termNew();
+		s->shared = 1;
+	}
+
+	s->type = t->type;
+	s->closed = t->closed;
+	s->normal = t->normal;
+	COPY_NAME(s, t);
+	s->index = t->index;
+	s->depth = t->depth;
+	SET_LTERM(s, t->type == TM_APPL ? freezeCopy(LTERM(t), cons) : NULL);
+	SET_RTERM(s, t->type == TM_APPL || t->type == TM_ABSTR ? freezeCopy(RTERM(t), cons) : NULL);
+
+	if(cons) {
+		TERM *found = map_find(consTerms, s);
+		if(found != NULL) {
+			// s is not used, its subterms are consed
+			SET_NEXT_FREE(s, sharedTerms);
+			sharedTerms = s;
+			return found;
+		}
+		map_insert(consTerms, s, s);
+	}
+
+	return s;
+}
+
+// termFreeze
+//
+// Returns a shared copy of t (see above) and frees t. The copy must be
+// released with termThaw. t must be closed (the declarations are), with the
+// hashcons option it is consed as a whole.
+
+TERM *termFreeze(TERM *t) {
+	assert(t->closed);
+
+	int cons = getOption(OPT_HASHCONS);
+	if(cons && consTerms == NULL) {
+		consTerms = map_create(consCompare, NULL, NULL);
+		map_set_hash_function(consTerms, consHash);
+	}
+
+	TERM *s = freezeCopy(t, cons);
+	termFree(t);
+	return s;
+}
+
+// termThaw
+//
+// Releases a term returned by termFreeze. Freed terms might still point to
+// its terms (their subterms are freed lazily, see termFree), so they are kept
+// shared and are reused only by termFreeze. Consed terms might be used by
+// other frozen terms, they are released by termConsClear.
+
+void termThaw(TERM *t) {
+	assert(t->shared);
+
+	if(termIsConsed(t))
+		return;
+
+	if(t->type == TM_APPL)
+		termThaw(LTERM(t));
+	if(t->type == TM_APPL || t->type == TM_ABSTR)
+		termThaw(RTERM(t));
+
+	SET_NEXT_FREE(t, sharedTerms);
+	sharedTerms = t;
+}
+
+// termConsClear
+//
+// Releases all consed terms, called when no frozen term uses them
+
+void termConsClear() {
+	if(consTerms == NULL)
+		return;
+
+	for(MapNode node = map_first(consTerms); node != MAP_EOF; node = map_next(consTerms, node)) {
+		TERM *t = map_node_key(consTerms, node);
+		SET_NEXT_FREE(t, sharedTerms);
+		sharedTerms = t;
+	}
+
+	map_destroy(consTerms);
+	consTerms = NULL;
+}
+
+// Free masks (see parser.h)
+//
+// The mask of a closure is not kept (depth is the index of its variable), all
+// variables up to its index might be free in it.
+
+static inline unsigned termFreeMask(TERM *t) {
+	if(t->type != TM_SUBST)
+		return FREE_MASK(t);
+	return t->index < 0 ? 0 : t->index >= FREE_BITS - 1 ? FREE_ALL : (2u << t->index) - 1;
+}
+
+// termUpdateFree
+//
+// Computes the free mask of t (which must not be a closure) from its index
+// (variables) or from the masks of its subterms
+
+void termUpdateFree(TERM *t) {
+	switch(t->type) {
+	 case TM_VAR:
+		FREE_MASK(t) = t->index >= 0 && t->index < FREE_BITS ? 1u << t->index : 0;
+		break;
+
+	 case TM_APPL:
+		FREE_MASK(t) = termFreeMask(LTERM(t)) | termFreeMask(RTERM(t));
+		break;
+
+	 case TM_ABSTR:
+		// variable FREE_BITS of the body is not in its mask, but it is in its index
+		FREE_MASK(t) = termFreeMask(RTERM(t)) >> 1 |
+			(RTERM(t)->index >= FREE_BITS ? 1u << (FREE_BITS - 1) : 0);
+		break;
+
+	 default:
+		assert(t->type == TM_ALIAS);		// aliases are closed terms
+		FREE_MASK(t) = 0;
+	}
+}
+
 // termSubst
 //
-// Replaces variable x in term M with term N.
-// Substitution is performed based on the definition at page 149 of the lecture notes
-// (update: 15 years later, the above comment sounds funny and useless :D)
+// Replaces the variable with index 'depth' in term M with term N. M is the
+// body of an abstraction which is removed by a beta-reduction, so variables
+// bound outside M have one abstraction less, and their indexes are decreased.
+// N is moved inside 'depth' abstractions of M, so its own variables bound
+// outside it are shifted by 'depth'.
+//
+// Since bound variables have no names, no alpha-conversion is ever needed.
+//
+// Returns 1 if N itself (not a clone) was placed in M, in which case the
+// remaining occurrences must use clones.
 //
 // Note:
 // closed flags are kept updated during conversions with minimum complexity cost
@@ -249,165 +1294,423 @@ TERM *termClone(TERM *t) {
 // without cost, so a term marked as non-closed could in fact be closed. But the
 // opposite should hold, terms marked as closed MUST be closed.
 
-static int termSubst(char *x, TERM *M, TERM *N, int mustClone) {
-	TERM z, *P, *clone;
-	int found = 0;
+static int termSubst(TERM *M, TERM *N, int depth, int mustClone) {
+	TERM *clone;
+	int used = 0;
 
-	// nothing can be substituted in closed terms
-	if(M->closed)
+	// nothing to do if all variables of M are bound inside the redex
+	// (this includes closed terms)
+	if(M->index < depth)
 		return 0;
 
 	switch(M->type) {
 	 case TM_VAR:
-	 	if(M->name == x) {		// fast compare, strings are interned
+		if(M->index == depth) {
 			if(mustClone) {
-				clone = termClone(N);
-				*M = *clone;
+				// clone the first occurrence, which is already shifted by substDepth
+				clone = termShare(substPlaced);
+				termMove(M, clone);
 
-				clone->lterm = clone->rterm = NULL;	// free but make sure that the
-				termFree(clone);					// subterms are not freed
-			} else
+				if(depth != substDepth)
+					termShift(M, depth - substDepth, 0);
+			} else {
 				*M = *N;
+				termShift(M, depth, 0);
 
-			found = 1;
+				used = 1;
+				substPlaced = M;
+				substDepth = depth;
+			}
+		} else {
+			// bound outside the redex
+			M->index--;
+			termUpdateFree(M);
 		}
 		break;
 
 	 case TM_APPL:
-		found = termSubst(x, M->lterm, N, mustClone);
-		found = termSubst(x, M->rterm, N, mustClone || found) || found;
+		// N might create a redex in M
+		M->normal = 0;
+
+		// only the subterms that are modified are unshared
+		if(LTERM(M)->index >= depth)
+			used = termSubst(termOwnL(M), N, depth, mustClone);
+		if(RTERM(M)->index >= depth)
+			used = termSubst(termOwnR(M), N, depth, mustClone || used) || used;
 
 		// if both branches become closed then M also becomes closed
-		M->closed = M->lterm->closed &&
-			 			M->rterm->closed;
+		M->closed = LTERM(M)->closed &&
+			 			RTERM(M)->closed;
+		M->index = LTERM(M)->index > RTERM(M)->index ? LTERM(M)->index : RTERM(M)->index;
+		termUpdateFree(M);
+		break;
+
+	 case TM_ABSTR:
+		M->normal = 0;
+		if(RTERM(M)->index >= depth + 1)
+			used = termSubst(termOwnR(M), N, depth + 1, mustClone);
+
+		// if the body becomes closed then M also becomes closed
+		M->closed = RTERM(M)->closed;
+		M->index = RTERM(M)->index > 0 ? RTERM(M)->index - 1 : VAR_FREE;
+		termUpdateFree(M);
+		break;
+
+	 case TM_ALIAS:
+		// aliases are closed terms so no substitution is possible
+		// We should never reach here because of the closed flag
+		assert(0);
 		break;
 
-	 case TM_ABSTR:		
-		P = M->rterm;
+	 case TM_SUBST:
+		// closures must be removed first (termForce)
+		assert(0);
+		break;
+	}
+
+	return used;
+}
+
+// termShift
+//
+// Adds d to the index of all variables of t which are bound outside t.
+// cutoff is the number of abstractions between the variable and t.
+
+static void termShift(TERM *t, int d, int cutoff) {
+	// nothing to shift if all variables are bound inside
+	if(t->index < cutoff || d == 0)
+		return;
+
+	// if the variable of a closure is shifted, it could fall among the variables removed
+	// by the shift, or its depth could overflow. In this case the closure is pushed first.
+	if(t->type == TM_SUBST && cutoff <= t->depth &&
+		(d < 0 ? t->depth < cutoff - d : t->depth + d > DEPTH_MAX))
+		termSubstHead(t);
+
+	// the largest index is shifted as well (but it cannot become smaller
+	// than the variables bound inside, which are not shifted)
+	t->index = t->index + d >= cutoff ? t->index + d : cutoff - 1;
+
+	// only the subterms that are modified are unshared
+	switch(t->type) {
+	 case TM_APPL:
+		if(LTERM(t)->index >= cutoff)
+			termShift(termOwnL(t), d, cutoff);
+		if(RTERM(t)->index >= cutoff)
+			termShift(termOwnR(t), d, cutoff);
+		break;
+
+	 case TM_ABSTR:
+		if(RTERM(t)->index >= cutoff + 1)
+			termShift(termOwnR(t), d, cutoff + 1);
+		break;
+
+	 case TM_SUBST:
+		// variable i of M[x:=N] is i in M if i < depth, otherwise i+1 in M or i-depth in N
+		if(cutoff > t->depth) {
+			if(LTERM(t)->index >= cutoff + 1)
+				termShift(termOwnL(t), d, cutoff + 1);
+
+			// an N used by other closures is cloned before shifting it
+			TERM *cell = RTERM(t);
+			if(RTERM(cell)->index >= cutoff - t->depth) {
+				if(cell->index > 1) {
+					SET_RTERM(t, cellNew(cellTake(cell)));
+					RTERM(t)->index = 1;
+				}
+				termShift(termOwnR(RTERM(t)), d, cutoff - t->depth);
+			}
+		} else {
+			// the variable of the closure is shifted as well
+			if(LTERM(t)->index >= cutoff)
+				termShift(termOwnL(t), d, cutoff);
+			t->depth += d;
+		}
+		return;
+
+	 default:
+		break;
+	}
+	termUpdateFree(t);
+}
+
+// Explicit substitutions
+//
+// With STRAT_EXPLICIT a beta-reduction \x.M N does not call termSubst, it
+// creates a closure M[x:=N]. The closure is pushed inside M only when the
+// search for the leftmost redex needs to see its type, so parts of M which
+// are discarded are never traversed.
+//
+// Pushing a closure inside an application creates two closures with the same
+// N, so N is kept in a cell (a TM_SUBST term without lterm, with rterm = N and
+// index = number of closures using it). N is cloned only when it replaces an
+// occurrence of x while other closures still use it.
+
+static TERM *cellNew(TERM *N) {
+	TERM *cell = termNew();
+	cell->type = TM_SUBST;
+	SET_LTERM(cell, NULL);
+	SET_RTERM(cell, N);
+	cell->index = 0;
+	return cell;
+}
+
+static void cellRelease(TERM *cell) {
+	if(--cell->index == 0)
+		termFree(cell);
+}
+
+// Returns the N of the cell (unshared), to be used only by the caller
+
+static TERM *cellTake(TERM *cell) {
+	TERM *N;
+
+	if(cell->index == 1) {
+		N = RTERM(cell);
+		SET_RTERM(cell, NULL);			// free the cell but not N
+		termFree(cell);
+	} else {
+		// (cloning can release other uses of the cell)
+		N = termShare(RTERM(cell));
+		cellRelease(cell);
+	}
+	return termUnshare(N);
+}
+
+// termClosure
+//
+// Returns a new closure M[x:=N], where x has index depth in M (which must
+// use it or some variable bound outside it, M->index >= depth)
+
+static TERM *termClosure(TERM *M, TERM *cell, int depth, char *name) {
+	TERM *t = termNew();
+	t->type = TM_SUBST;
+	SET_NAME(t, name);
+	SET_LTERM(t, M);
+	SET_RTERM(t, cell);
+	t->depth = depth;
+	t->closed = 0;
+	cell->index++;
+
+	// largest index of M (without x) or N (moved inside depth abstractions)
+	TERM *N = RTERM(cell);
+	int indexM = M->index > depth ? M->index - 1 : depth - 1,
+		indexN = N->index >= 0 ? N->index + depth : VAR_FREE;
+	t->index = indexM > indexN ? indexM : indexN;
+
+	return t;
+}
+
+// termSubstStep
+//
+// Pushes closure t = M[x:=N] one step inside M (which must not be a closure),
+// so t gets the type of M
+
+static void termSubstStep(TERM *t) {
+	TERM *M = LTERM(t);				// might be shared, see termFreeze
+	TERM *cell = RTERM(t);
+	int depth = t->depth;
+	char *name = NAME(t);
+
+	assert(M->type != TM_SUBST);
+
+	if(M->type == TM_ABSTR && depth == DEPTH_MAX) {
+		// the depth of the new closure cannot be stored, substitute directly
+		M = termOwnL(t);
+		TERM *N = cellTake(cell);
+		termForce(M);
+		termForce(N);
+
+		char closed = t->closed;
+		int found = termSubst(M, N, depth, 0);
+		*t = *M;
+		t->closed = M->closed || closed;
+
+		SET_LTERM(M, NULL); SET_RTERM(M, NULL);
+		termFree(M);
+		if(found) {
+			SET_LTERM(N, NULL); SET_RTERM(N, NULL);
+		}
+		termFree(N);
+		return;
+	}
 
-		// case 1: x = y
-		if(M->name == x)	// fast comparison, strings are interned
+	switch(M->type) {
+	 case TM_VAR:
+		if(M->index == depth) {
+			// x[x:=N] -> N, moved inside depth abstractions
+			TERM *N = cellTake(cell);
+			termShift(N, depth, 0);
+			termMove(t, N);
+			termFree(M);
 			break;
+		}
+		// fall through
 
-		// If y is free in N then we should alpha-convert it to a different name to avoid capture
-		// except if x is not free in P in which case no substitution will happen anyway
-		//
-		// NOTE
-		// termIsFreeVar is a very constly check to make, and it is performed billions of times.
-		// However, in 'practical' cases we never need to make such substitutions so these costly tests
-		// always fail (in Queens N example we never enter in the following if).
-		// Some profiling showed that 77% percent of the execution time was spent in termIsFree and
-		// putting the hole 'if' in comments leads to an incredible speed boost (Queens 5 solved in 2 seconds
-		// instead of 50) however it breaks the cases where substitution IS needed, for example where we
-		// have free variables:
-		//   (\x.\y.y x) y  ->  \a.a y  (bound y renamed to a)
-		//   but with the 'if' in comments we incorrectly get \y.y y
-		//
-		// Starting with version 0.5 a good optimization is made using the term's 'closed' flag. In practical
-		// cases we are using only closed terms. To exploit this fact each term has a closed flag which is calculated
-		// once in the beggining of the execution and is updated during the conversions whenever possible without
-		// computational overhead. A closed flag means that termSubst and termIsFreeVar can return immediately without
-		// inspecting the term. This gives almost the same performance boost as removing the 'if' (but without breaking
-		// cases with free variables), still some termIsFrees are called but very few.
-		// Note: termIsFreeVar checks the closed flag itself but in the following 'if' we first check N->closed and
-		//       P->closed to avoid extra function calls and avoid calling termIsFreeVar(N, y->name) if P->closed is set
-		// 
-		if(!N->closed && !P->closed &&
-			termIsFreeVar(N, M->name) && termIsFreeVar(P, x)
-			) {
-			//printf("ISFREE\n");
-
-			// x in FV(P) kai y in FV(N)
-			// bound variable must be renamed before performing P[x:=N]
-			z.type = TM_VAR;
-			z.name = getVariable(N, P);
-			z.closed = 0;
-
-			termSubst(M->name, P, &z, 1);
-			M->name = z.name;
-		}
-		found = termSubst(x, P, N, mustClone);
-
-		// if P becomes closed then M also becomes closed
-		M->closed = P->closed;
+	 case TM_ALIAS:
+		termMove(t, M);
+		if(t->index > depth) {			// variable bound outside
+			t->index--;
+			termUpdateFree(t);
+		}
+		cellRelease(cell);
 		break;
 
-	 case TM_ALIAS:
-		// aliases are closed terms so no substitution is possible
-		// We should never reach here because of the closed flag
-		assert(0);
-		break;
+	 case TM_ABSTR: {
+		// (\y.B)[x:=N] -> \y.(B[x:=N]), x has index depth+1 in B
+		TERM *B = RTERM(M);
+		if(B->index > depth)
+			B = termClosure(B, cell, depth + 1, name);
+
+		t->type = TM_ABSTR;
+		COPY_NAME(t, M);
+		SET_RTERM(t, B);
+		t->index = B->index > 0 ? B->index - 1 : VAR_FREE;
+		termUpdateFree(t);
+
+		if(!M->shared) {
+			SET_RTERM(M, NULL);
+			termFree(M);
+		}
+		cellRelease(cell);
+		break;
+	 }
+
+	 case TM_APPL: {
+		// (A B)[x:=N] -> A[x:=N] B[x:=N]
+		TERM *A = LTERM(M);
+		TERM *B = RTERM(M);
+
+		if(A->index >= depth)
+			A = termClosure(A, cell, depth, name);
+		if(B->index >= depth)
+			B = termClosure(B, cell, depth, name);
+
+		t->type = TM_APPL;
+		COPY_NAME(t, M);			// keep operator ~
+		SET_LTERM(t, A);
+		SET_RTERM(t, B);
+		t->index = A->index > B->index ? A->index : B->index;
+		termUpdateFree(t);
+
+		if(!M->shared) {
+			SET_LTERM(M, NULL); SET_RTERM(M, NULL);
+			termFree(M);
+		}
+		cellRelease(cell);
+		break;
+	 }
+
+	 default:										// we never reach here!
+		assert(0);
+	}
+}
+
+// termSubstHead
+//
+// Pushes the closures at the top of t (the innermost first), until t is not a
+// closure
+
+static void termSubstHead(TERM *t) {
+	if(t->type != TM_SUBST)
+		return;
+
+	int init_size = termStackSize();
+	termPush(t);
+
+	while(termStackSize() > init_size) {
+		t = termHead();
+		if(t->type != TM_SUBST)
+			termPop();
+		else if(LTERM(t)->type == TM_SUBST)
+			termPush(LTERM(t));
+		else
+			termSubstStep(t);
+	}
+}
+
+// termForce
+//
+// Pushes all closures of t until none is left
+
+static void termForce(TERM *t) {
+	int init_size = termStackSize();
+	termPush(t);
+
+	while(termStackSize() > init_size) {
+		t = termPop();
+		if(t->shared)					// declarations have no closures
+			continue;
+		termSubstHead(t);
+
+		if(t->type == TM_APPL) {
+			termPush(LTERM(t));
+			termPush(RTERM(t));
+		} else if(t->type == TM_ABSTR) {
+			termPush(RTERM(t));
+		}
 	}
-
-	return found;
 }
 
-// Returns 1 if variable 'name' (must be interned) belongs to the
-// free variables of term t, otherwise 0.
+// Returns 1 if the variable with the given de Bruijn index (relative to t)
+// appears in t, otherwise 0.
 
 #ifndef NDEBUG
 int freeNo;				// count the number of terms processed by termIsFree
 #endif
-static int termIsFreeVar(TERM *t, char *name) {
+static int termIsFreeIndex(TERM *t, int index) {
 	assert(t);
 
-	// Note: use the stack only when we need to add a second item to process
-	int found = 0;
+	// t->index is the largest index in t, and a clear bit in its free mask
+	// is certain (see parser.h)
+	if(t->index < index || (index < FREE_BITS && !(termFreeMask(t) >> index & 1)))
+		return 0;
 
-	for(int todo = 1; todo > 0; todo--) {
-		if(!t)
-			t = termPop();
+	#ifndef NDEBUG
+	freeNo++;
+	#endif
 
-		// nothing to do if already found or term is closed
-		// (closed terms have no free variables).
-		if(found || t->closed) {
-			t = NULL;
-			continue;
-		}
+	switch(t->type) {
+	 case TM_VAR:
+		return t->index == index;
 
-		#ifndef NDEBUG
-		freeNo++;
-		#endif
+	 case TM_APPL:
+		return termIsFreeIndex(LTERM(t), index) ||
+			termIsFreeIndex(RTERM(t), index);
 
-		switch(t->type) {
-			case TM_VAR:
-				if(t->name == name)
-					found = 1;
-				t = NULL;
-				break;
+	 case TM_ABSTR:
+		return termIsFreeIndex(RTERM(t), index + 1);
 
-			case TM_APPL:
-				termPush(t->lterm);
-				t = t->rterm;
-				todo += 2;
-				break;
+	 case TM_SUBST:
+		// push the closure, looking inside M and N separately could visit
+		// nested closures many times
+		termSubstHead(t);
+		return termIsFreeIndex(t, index);
 
-			case TM_ABSTR:
-				if(t->name != name) {
-					t = t->rterm;
-					todo++;
-				} else {
-					// name cannot be free inside an abstraction of the same name
-					t = NULL;
-				}
-				break;
-			
-			case TM_ALIAS:
-				// aliases must be closed terms (no free variables)!
-				t = NULL;
-				break;
-		}
+	 default:
+		// aliases must be closed terms (no free variables)!
+		return 0;
 	}
-
-	return found;
 }
 
 // termConv
 //
-// Performs the left-most beta or eta reduction in term t
+// Performs the left-most beta or eta reduction in term t. With STRAT_EXPLICIT
+// beta-reductions create closures (see termSubstStep), the closures that the
+// search reaches are pushed before continuing.
+//
+// The search does not start from the root in every call. The path from the
+// root to the last reduction is kept (see CONV_SEARCH), and the next call
+// continues from the outermost term of the path that the reduction could
+// have made a redex (see convResume), everything before it in the search has
+// no redex. So execTerm's loop, which calls termConv on the same term until
+// there is no reduction, does not search again the parts of the term which
+// are already in normal form. termConvReset must be called before reducing a
+// new term.
 //
 // Returns
-// 	1	If a reduction was found
+// 	n>0	The number of reductions performed (more than 1 when an alias is
+//			instantiated, see termInstantiate)
 //		0	If there is no reduction
 //		-1	If some error happened
 //
@@ -417,21 +1720,160 @@ static int termIsFreeVar(TERM *t, char *name) {
 // without cost, so a term marked as non-closed could in fact be closed. But the
 // opposite should hold, terms marked as closed MUST be closed.
 
-int termConv(TERM *t) {
-	static char* str_tilde = NULL;
-	if(str_tilde == NULL)
-		str_tilde = str_intern("~");
+static void spinePush(CONV_SEARCH *s, TERM *t, SPINE_DIR dir) {
+	if(s->spineNo == s->spineCapacity) {
+		s->spineCapacity = s->spineCapacity ? 2*s->spineCapacity : 1000;
+		s->spine = realloc(s->spine, s->spineCapacity * sizeof(*s->spine));
+		assert(s->spine);
+	}
+	s->spine[s->spineNo++] = (SPINE_ENTRY){ t, dir };
+}
 
-	// verify that the closed bit has been set and is not garbage
-	assert(t->closed == 0 || t->closed == 1);
+// Keeps the first n entries of the spine
+
+static void spineTruncate(CONV_SEARCH *s, int n) {
+	s->spineNo = n;
+	while(s->etaNo > 0 && s->etas[s->etaNo-1] >= n - 1)
+		s->etaNo--;
+}
 
-	int result = 0;
+// Marks the abstraction at position pos of the spine, whose body \x.M x is
+// searched next (in M), as a possible eta-redex
 
-	for(int todo = 1; todo > 0; todo--) {
-		if(!t)
-			t = termPop();
+static void etaPush(CONV_SEARCH *s, int pos) {
+	if(s->etaNo == s->etaCapacity) {
+		s->etaCapacity = s->etaCapacity ? 2*s->etaCapacity : 100;
+		s->etas = realloc(s->etas, s->etaCapacity * sizeof(*s->etas));
+		assert(s->etas);
+	}
+	s->etas[s->etaNo++] = pos;
+}
+
+// Returns 1 if t = \x.M x with x not free in M (t must be an abstraction)
+
+static int termIsEtaRedex(TERM *t, int explicit) {
+	if(explicit) {
+		termSubstHead(RTERM(t));
+		if(RTERM(t)->type == TM_APPL)
+			termSubstHead(RTERM(RTERM(t)));
+	}
+
+	TERM *L = RTERM(t);			// M x
+	return L->type == TM_APPL &&
+		RTERM(L)->type == TM_VAR &&
+		RTERM(L)->index == 0 &&
+		!termIsFreeIndex(LTERM(L), 0);
+}
+
+// convResume
+//
+// Called before searching again after a reduction at t (the terms above it in
+// the search are in the spine), returns where the search starts. This is not
+// done right after the reduction, checking for eta-redexes might push closures
+// (which would be visible with showexec). Only t was changed, so a term above
+// it can only have become a redex if
+//   - it is \x.M x with t in M, x might not appear in M any more.
+//   - it is \x.M t, t might have become x.
+//   - it is an abstraction with body t.
+//   - it is an application with left subterm t, t might have become an
+//     abstraction (or an alias or closure of one).
+//   - it is the outermost application A A1 ... Ak with t in the place of A,
+//     and t now starts with an alias (see termInstantiate).
+// If none is, the search continues from t itself.
+
+static TERM *convResume(CONV_SEARCH *s, TERM *t, int explicit, int fuse) {
+	int n = s->spineNo;
+
+	for(int i = 0; i < s->etaNo; i++) {
+		int pos = s->etas[i];
+		if(termIsEtaRedex(s->spine[pos].term, explicit)) {
+			t = s->spine[pos].term;
+			spineTruncate(s, pos);
+			return t;
+		}
+	}
+
+	if(n >= 2 && (s->spine[n-1].dir == SPINE_RIGHT || s->spine[n-1].dir == SPINE_TILDE) &&
+		s->spine[n-2].dir == SPINE_BODY && termIsEtaRedex(s->spine[n-2].term, explicit)) {
+		t = s->spine[n-2].term;
+		spineTruncate(s, n-2);
+		return t;
+	}
+
+	TERM *head = t;
+	while(head->type == TM_APPL)
+		head = LTERM(head);
+
+	if(fuse && head->type == TM_ALIAS)
+		while(n > 0 && s->spine[n-1].dir == SPINE_LEFT)
+			n--;
 
-		if(result) {
+	if(n == s->spineNo && n > 0 && (s->spine[n-1].dir == SPINE_BODY ||
+		(s->spine[n-1].dir == SPINE_LEFT && t->type != TM_APPL && t->type != TM_VAR)))
+		n--;
+
+	if(n < s->spineNo)
+		t = s->spine[n].term;
+	spineTruncate(s, n);
+	return t;
+}
+
+// Called after a reduction at t, the next search starts from a term above it
+// (see convResume)
+
+static int convReduced(CONV_SEARCH *s, TERM *t, int result) {
+	s->next = t;
+	s->reduced = 1;
+	return result;
+}
+
+// Performs the next reduction of search s, see termConv
+
+static int convSearchNext(CONV_SEARCH *s) {
+	char *str_tilde = str_symbol(SYM_TILDE);
+
+	int result,
+		explicit = getOption(OPT_STRATEGY) == STRAT_EXPLICIT,
+		fuse = !explicit && !trace && !getOption(OPT_SHOWEXEC);
+
+	TERM *t = s->reduced ? convResume(s, s->next, explicit, fuse) : s->next;
+	TERM *tildeDone = NULL;		// ~ application whose right subterm has no redex
+	s->reduced = 0;
+
+	while(1) {
+		if(t == NULL) {
+			// nothing found in the last subterm, continue with the right subterm of
+			// the innermost application searched on the left
+			while(t == NULL && s->spineNo > 0) {
+				SPINE_ENTRY *entry = &s->spine[s->spineNo-1];
+
+				if(entry->dir == SPINE_LEFT) {
+					// the abstraction above (if any) is not an eta-redex now
+					if(s->etaNo > 0 && s->etas[s->etaNo-1] == s->spineNo - 2)
+						s->etaNo--;
+					entry->dir = SPINE_RIGHT;
+					t = termOwnR(entry->term);
+
+				} else if(entry->dir == SPINE_TILDE) {
+					// the argument of ~ is in normal form, reduce the application itself
+					t = tildeDone = entry->term;
+					spineTruncate(s, s->spineNo - 1);
+
+				} else {
+					// no redex in the application or abstraction, nor in its subterms
+					entry->term->normal = 1;
+					spineTruncate(s, s->spineNo - 1);
+				}
+			}
+
+			if(t == NULL) {
+				s->root = NULL;			// normal form, nothing to resume
+				return 0;
+			}
+		}
+
+		// already searched
+		if(t->normal) {
 			t = NULL;
 			continue;
 		}
@@ -444,75 +1886,94 @@ int termConv(TERM *t) {
 			case TM_ABSTR: {
 				// Check for eta-conversion
 				// \x.M x -> M  if x not free in M
-				TERM *L = t->rterm;			// M x
-				TERM *M = L->lterm;
-				TERM *N = L->rterm;
-				char *x = t->name;
-
-				if(L->type == TM_APPL &&
-					N->type == TM_VAR &&
-					N->name == x &&
-					!termIsFreeVar(M, x)) {
-
-					// eta-conversion
+				if(termIsEtaRedex(t, explicit)) {
+					// eta-conversion, M is moved outside the abstraction
+					TERM *L = termOwnR(t);
+					TERM *M = termOwnL(L);
+					termShift(M, -1, 0);
 					*t = *M;
 
 					// free terms. By freeing L we also free M,N, but we
 					// should _not_ free M's subterms (they are copied in t)
-					M->lterm = M->rterm = NULL;
+					SET_LTERM(M, NULL); SET_RTERM(M, NULL);
 					termFree(L);
 
-					result = 1;
-					t = NULL;
-					break;
+					return convReduced(s, t, 1);
 				}
 
-				t = t->rterm;
-				todo++;
+				// the terms visited by the search are unshared, they might be modified
+				spinePush(s, t, SPINE_BODY);
+				t = termOwnR(t);
 				break;
 			}
 
 			case TM_APPL: {
 				// If the left-most term is an alias it needs to be substituted cause it might contain
 				// an abstraction. while is needed cause we might still have an alias afterwards.
-				while(t->lterm->type == TM_ALIAS)
-					if(termAliasSubst(t->lterm) != 0) {
-						result = -1;
-						t = NULL;
-						break;
+				if(explicit)
+					termSubstHead(LTERM(t));
+
+				// an alias or abstraction applied to arguments is instantiated in one
+				// pass. Not while tracing, every reduction is shown then.
+				if(fuse && (LTERM(t)->type == TM_APPL || LTERM(t)->type == TM_ALIAS) &&
+					(result = termInstantiate(t)) > 0) {
+					return convReduced(s, t, result);
+				}
+
+				while(LTERM(t)->type == TM_ALIAS)
+					if(termAliasSubst(termOwnL(t), 1) != 0) {
+						s->root = NULL;
+						return -1;
 					}
 
 				// If no abstraction exist on the left-hand side then a beta-reduction is not possible,
 				// so we continue the search in the tree.
-				if(t->lterm->type != TM_ABSTR) {
-					// push rterm for later
-					termPush(t->rterm);
-
-					// search the lterm first
-					t = t->lterm;
-					todo += 2;
+				if(LTERM(t)->type != TM_ABSTR) {
+					// the body of \x.M x, M is searched first
+					if(s->spineNo > 0 && s->spine[s->spineNo-1].dir == SPINE_BODY &&
+						RTERM(t)->type == TM_VAR && RTERM(t)->index == 0)
+						etaPush(s, s->spineNo - 1);
+
+					// search the lterm first, the rterm later
+					spinePush(s, t, SPINE_LEFT);
+					t = termOwnL(t);
 					break;
 				}
 
 				// If the application has beed defined with ~,
 				// we perform the reductions in the right subtree first (call-by-value)
-				//
-				// TODO: recursion still exists here, although it should be limited
-				int res;
-				if(t->name == str_tilde && (res = termConv(t->rterm)) != 0) {
-					result = res;
-					t = NULL;
+				if(NAME(t) == str_tilde && t != tildeDone) {
+					spinePush(s, t, SPINE_TILDE);
+					t = termOwnR(t);
 					break;
 				}
 
-				TERM *L = t->lterm;		// L = \x.M
-				char *x = L->name;
-				TERM *M = L->rterm;
-				TERM *N = t->rterm;
+				TERM *L = termOwnL(t);	// L = \x.M
+				TERM *M = RTERM(L);
+				TERM *N = RTERM(t);
 
 				// beta-reduction: \x.M N -> M[x:=N]
 				char closed = t->closed;
-				int found = termSubst(x, M, N, 0);
+
+				if(explicit && M->index >= 0) {
+					// the closure is pushed later
+					TERM *closure = termClosure(M, cellNew(N), 0, NAME(L));
+					*t = *closure;
+					t->closed = closed;
+
+					SET_LTERM(closure, NULL); SET_RTERM(closure, NULL);
+					termFree(closure);
+					SET_RTERM(L, NULL);
+					termFree(L);
+
+					return convReduced(s, t, 1);
+				}
+
+				// M and N are modified by termSubst
+				M = termOwnR(L);
+				N = termOwnR(t);
+
+				int found = termSubst(M, N, 0, 0);
 				*t = *M;
 
 				// if t was closed, it remains closed (bete-conversion does not introduce free variables)
@@ -523,35 +1984,73 @@ int termConv(TERM *t) {
 
 				// free terms. freeing L will also free x,M, but in case of M we
 				// should not free its subterms (which have been copied to t)
-				M->lterm = M->rterm = NULL;
+				SET_LTERM(M, NULL); SET_RTERM(M, NULL);
 				termFree(L);
 
-				if(found)							// if N was substituted in M, we should
-					N->lterm = N->rterm = NULL;		// not free its subterms
+				if(found) {							// if N was substituted in M, we should
+					SET_LTERM(N, NULL); SET_RTERM(N, NULL);		// not free its subterms
+				}
 				termFree(N);
 
-				result = 1;
-				t = NULL;
+				return convReduced(s, t, 1);
+			}
+
+			case TM_SUBST:
+				// push the closure and search again
+				termSubstHead(t);
 				break;
 
 			case TM_ALIAS:
 				// to check for reductions we need to substitute the alias with the corresponding term
-				if(termAliasSubst(t) != 0) {
-					result = -1;
-					t = NULL;
-				} else {
-					// leave t as is to search for reductions in the new term
-					todo++;
+				if(termAliasSubst(t, 1) != 0) {
+					s->root = NULL;
+					return -1;
 				}
+				// leave t as is to search for reductions in the new term
 				break;
-			}
 
 			default:										// we never reach here!
 				assert(0);
 		}
 	}
+}
 
-	return result;
+int termConv(TERM *t) {
+	// verify that the closed bit has been set and is not garbage
+	assert(t->closed == 0 || t->closed == 1);
+
+	if(convBusy) {
+		// called while reducing another term (when a declaration is lifted, see
+		// liftNormalize), a new search is used
+		CONV_SEARCH s = { .root = t, .next = t };
+		int res = convSearchNext(&s);
+		free(s.spine);
+		free(s.etas);
+		return res;
+	}
+
+	if(convSearch.root != t) {
+		convSearch.root = convSearch.next = t;
+		convSearch.reduced = 0;
+		spineTruncate(&convSearch, 0);
+	}
+
+	convBusy = 1;
+	int res = convSearchNext(&convSearch);
+	convBusy = 0;
+	return res;
+}
+
+// termConvReset
+//
+// Forgets the search of termConv, the next call starts from the root. Must be
+// called before reducing a new term (the old one might have been freed, and
+// the new one allocated at the same place), and whenever the term is changed
+// other than by termConv.
+
+void termConvReset() {
+	if(!convBusy)
+		convSearch.root = NULL;
 }
 
 // Decode Scott numerals (with inversed argument order):
@@ -562,17 +2061,17 @@ static int scottNumeral(TERM *t) {
 	int n = 0;
 
 	while(1) {
-		if(t->type != TM_ABSTR || t->rterm->type != TM_ABSTR)
+		if(t->type != TM_ABSTR || RTERM(t)->type != TM_ABSTR)
 			return -1;
 
-		TERM *body = t->rterm->rterm;
+		TERM *body = RTERM(RTERM(t));
 
-		if(body->type == TM_VAR && body->name == t->rterm->name)
+		if(body->type == TM_VAR && body->index == 0)			// z
 			return n;
 
-		if(body->type == TM_APPL && body->lterm->type == TM_VAR && body->lterm->name == t->name) {
+		if(body->type == TM_APPL && LTERM(body)->type == TM_VAR && LTERM(body)->index == 1) {	// s <N>
 			n++;
-			t = body->rterm;
+			t = RTERM(body);
 		} else {
 			return -1;
 		}
@@ -583,24 +2082,21 @@ static int scottNumeral(TERM *t) {
 //    <N> = \f.\x.f^N(x)
 //
 static int churchNumeral(TERM *t) {
-	// first term must be \f.
+	// first term must be \f. (f has index 1 in the body)
 	if(t->type != TM_ABSTR) return -1;
-	char *f = t->name;
 
-	// second term must be \x. with x != f
-	if(t->rterm->type != TM_ABSTR) return -1;
-	char *x = t->rterm->name;
-	if(f == x) return -1;
+	// second term must be \x. (x has index 0 in the body)
+	if(RTERM(t)->type != TM_ABSTR) return -1;
 
 	// recognize term f^n(x), compute n
 	int n = 0;
-	for(TERM *cur = t->rterm->rterm; ; cur = cur->rterm, n++) {
-		if(cur->type == TM_VAR && cur->name == x)
+	for(TERM *cur = RTERM(RTERM(t)); ; cur = RTERM(cur), n++) {
+		if(cur->type == TM_VAR && cur->index == 0)
 			return n;
 
 		if(cur->type != TM_APPL ||
-			cur->lterm->type != TM_VAR ||
-			cur->lterm->name != f)
+			LTERM(cur)->type != TM_VAR ||
+			LTERM(cur)->index != 1)
 			return -1;
 	}
 }
@@ -616,12 +2112,12 @@ static int churchNumeral(TERM *t) {
 int termNumber(TERM *t) {
 	// Unprocessed: Succ(...(Succ(0))
 	//
-	char *succ = str_intern("Succ");
+	char *succ = str_symbol(SYM_SUCC);
 	int n = 0;
-	for(; t->type == TM_APPL && t->lterm->type == TM_ALIAS && t->lterm->name == succ; n++, t = t->rterm)
+	for(; t->type == TM_APPL && LTERM(t)->type == TM_ALIAS && NAME(LTERM(t)) == succ; n++, t = RTERM(t))
 		;
 
-	if(t->type == TM_ALIAS && t->name == str_intern("0"))
+	if(t->type == TM_ALIAS && NAME(t) == str_symbol(SYM_ZERO))
 		return n;
 
 	// Scott numerals
@@ -642,21 +2138,21 @@ static int termIsList(TERM *t) {
 		if(t->type != TM_ABSTR)
 			return 0;
 
-		TERM *r = t->rterm;
+		TERM *r = RTERM(t);
 
 		// check for the form \s.s Head Tail
 		if(r->type == TM_APPL &&
-			r->lterm->type == TM_APPL &&
-			r->lterm->lterm->type == TM_VAR &&
-			r->lterm->lterm->name == t->name) {
+			LTERM(r)->type == TM_APPL &&
+			LTERM(LTERM(r))->type == TM_VAR &&
+			LTERM(LTERM(r))->index == 0) {
 
-			t = r->rterm;
+			t = RTERM(r);
 
 		// check for the form [] = \x.\x.\y.x
 		} else if(r->type == TM_ABSTR &&
-			r->rterm->type == TM_ABSTR &&
-			r->rterm->rterm->type == TM_VAR &&
-			r->rterm->rterm->name == r->name) {
+			RTERM(r)->type == TM_ABSTR &&
+			RTERM(RTERM(r))->type == TM_VAR &&
+			RTERM(RTERM(r))->index == 1) {
 
 			return 1;
 
@@ -669,8 +2165,8 @@ static int termIsList(TERM *t) {
 static int termIsIdentity(TERM *t) {
 	return
 		t->type == TM_ABSTR &&
-		t->rterm->type == TM_VAR &&
-		t->name == t->rterm->name;
+		RTERM(t)->type == TM_VAR &&
+		RTERM(t)->index == 0;
 }
 
 // termPrintList
@@ -679,44 +2175,205 @@ static int termIsIdentity(TERM *t) {
 // (termIsList(t) must return 1).
 
 static void termPrintList(TERM *t) {
-	TERM *r;
 	int i = 0;
 
 	printf("[");
 
-	for(r = t->rterm; r->type == TM_APPL; r = r->rterm->rterm) {
+	// each element is inside the abstractions \s. of all the previous cells
+	for(; RTERM(t)->type == TM_APPL; t = RTERM(RTERM(t))) {
+		pushPrintName(termAbstrName(t));
+
 		if(i++ > 0) printf(", ");
-		termPrint(r->lterm->rterm, 1);
+		termPrint(RTERM(LTERM(RTERM(t))), 1);
 	}
 
+	printNameNo -= i;
 	printf("]");
 }
 
 // termAliasSubst
 //
-// Substitutes aliast t with its corresponding term. Returns 0 if the term was found
-// or 1 if the alias is undefined.
+// Substitutes aliast t with its corresponding term, after lifting if 'lifted' is
+// set (see lift.c). Returns 0 if the term was found or 1 if the alias is undefined.
+// The lifted term is shared, only its top term is copied in t.
 
-static int termAliasSubst(TERM *t) {
-	TERM *newTerm;
+static int termAliasSubst(TERM *t, int lifted) {
+	TERM *newTerm = lifted ? getLiftedTerm(NAME(t)) : termFromDecl(NAME(t));
 
-	if(!(newTerm = termFromDecl(t->name))) {
-		printf("Error: Alias %s is not declared.\n", t->name);
+	if(newTerm == NULL) {
+		printf("Error: Alias %s is not declared.\n", NAME(t));
 		return 1;
 	}
 
 	assert(newTerm->closed == 1);
 
-	// substitute term
-	*t = *newTerm;
-
-	// free newTerm, but without its subterms (which are copied in t)
-	newTerm->lterm = newTerm->rterm = NULL;
-	termFree(newTerm);
+	// substitute term (and free newTerm, but without its subterms)
+	termMove(t, lifted ? termShare(newTerm) : newTerm);
 
 	return 0;
 }
 
+// instSubst
+//
+// Replaces in M (which is 'depth' abstractions inside the body of the n
+// abstractions being applied) their variables with the arguments in instArgs,
+// as termSubst does for a single argument. Variables bound outside the n
+// abstractions have n abstractions less. The first occurrence of an argument
+// is the argument itself, the next ones are clones. Only the subterms which
+// are modified are unshared, so the body of an alias is copied only where it
+// uses some argument.
+
+static void instSubst(TERM *M, int depth, int n) {
+	// nothing to replace if all variables of M are bound inside it
+	if(M->index < depth)
+		return;
+
+	switch(M->type) {
+	 case TM_VAR: {
+		int i = M->index - depth;
+
+		if(i >= n) {
+			// bound outside the abstractions
+			M->index -= n;
+			termUpdateFree(M);
+		} else if(instPlaced[i] == NULL) {
+			termMove(M, termUnshare(instArgs[i]));
+			termShift(M, depth, 0);
+			instPlaced[i] = M;
+			instDepth[i] = depth;
+		} else {
+			termMove(M, termShare(instPlaced[i]));
+			termShift(M, depth - instDepth[i], 0);
+		}
+		break;
+	 }
+
+	 case TM_APPL:
+		// the arguments might create a redex in M
+		M->normal = 0;
+
+		if(LTERM(M)->index >= depth)
+			instSubst(termOwnL(M), depth, n);
+		if(RTERM(M)->index >= depth)
+			instSubst(termOwnR(M), depth, n);
+
+		// as in termSubst
+		M->closed = LTERM(M)->closed && RTERM(M)->closed;
+		M->index = LTERM(M)->index > RTERM(M)->index ? LTERM(M)->index : RTERM(M)->index;
+		termUpdateFree(M);
+		break;
+
+	 case TM_ABSTR:
+		M->normal = 0;
+		if(RTERM(M)->index >= depth + 1)
+			instSubst(termOwnR(M), depth + 1, n);
+
+		M->closed = RTERM(M)->closed;
+		M->index = RTERM(M)->index > 0 ? RTERM(M)->index - 1 : VAR_FREE;
+		termUpdateFree(M);
+		break;
+
+	 default:
+		// aliases are closed, and there are no closures (see termConv)
+		assert(0);
+	}
+}
+
+// termInstantiate
+//
+// If t is an application A A1 ... Ak of an alias or an abstraction
+// A = \x1...\xm.M, the leftmost n = min(k, m) beta-reductions are performed
+// at once: M is traversed only once, with A1 ... An placed directly at the
+// occurrences of x1 ... xn, instead of substituting each argument separately
+// (and, for an alias, cloning A first). Applications with ~ are left to termConv
+// (their argument is reduced first).
+//
+// Returns the number of beta-reductions performed, 0 if t is not such an
+// application (or A is undefined, the error is reported by termAliasSubst).
+
+static int termInstantiate(TERM *t) {
+	char *str_tilde = str_symbol(SYM_TILDE);
+
+	int k = 0;
+	TERM *head;
+	for(head = t; head->type == TM_APPL; head = LTERM(head))
+		k++;
+
+	// get the declaration before using the static arrays, it might be lifted now
+	// (and termConv called recursively)
+	TERM *decl = head;
+	if(head->type == TM_ALIAS)
+		decl = getLiftedTerm(NAME(head));
+	if(decl == NULL || decl->type != TM_ABSTR)
+		return 0;
+
+	if(k > instSpineCapacity) {
+		instSpineCapacity = 2*k;
+		instSpine = realloc(instSpine, instSpineCapacity * sizeof(*instSpine));
+		assert(instSpine);
+	}
+	TERM *app = t;
+	for(int i = 0; i < k; i++, app = LTERM(app))
+		instSpine[i] = app;		// (might be shared, see below)
+
+	// n arguments can be placed, the application of the n-th one is replaced
+	// by the result (the arguments are instSpine[k-1]->rterm ... instSpine[k-n]->rterm)
+	int n = 0;
+	TERM *abstr = NULL, *body = decl;		// body of the n-th abstraction
+	while(n < k && body->type == TM_ABSTR && NAME(instSpine[k-1-n]) != str_tilde) {
+		abstr = body;
+		body = RTERM(body);
+		n++;
+	}
+	if(n == 0)
+		return 0;
+
+	// the n-th application is modified, so it is unshared along with the ones above it
+	for(int i = 1; i <= k-n; i++)
+		instSpine[i] = termOwnL(instSpine[i-1]);
+
+	if(n > instArgCapacity) {
+		instArgCapacity = 2*n;
+		instArgs = realloc(instArgs, instArgCapacity * sizeof(*instArgs));
+		instPlaced = realloc(instPlaced, instArgCapacity * sizeof(*instPlaced));
+		instDepth = realloc(instDepth, instArgCapacity * sizeof(*instDepth));
+		assert(instArgs && instPlaced && instDepth);
+	}
+
+	// xn has index 0 in the body, x1 has index n-1
+	for(int i = 0; i < n; i++) {
+		instArgs[i] = RTERM(instSpine[k-n+i]);
+		instPlaced[i] = NULL;
+	}
+
+	// the body of an alias is copied (only where it is modified, if it is frozen),
+	// the body of an abstraction is moved out of it (the abstraction is freed below)
+	TERM *res = termUnshare(head->type == TM_ALIAS ? termShare(body) : body);
+	if(res == body)
+		SET_RTERM(abstr, NULL);
+	instSubst(res, 0, n);
+
+	// replace the n-th application. Free its left part (the alias and the other
+	// applications) but not the arguments, those that were not placed are freed
+	app = instSpine[k-n];
+	char closed = app->closed;
+	TERM *old = LTERM(app);
+
+	for(int i = k-n+1; i < k; i++)
+		if(!instSpine[i]->shared)
+			SET_RTERM(instSpine[i], NULL);
+	termFree(old);
+
+	for(int i = 0; i < n; i++)
+		if(instPlaced[i] == NULL)
+			termFree(instArgs[i]);
+
+	termMove(app, res);
+	app->closed = app->closed || closed;		// the application was closed, so is the result
+
+	return n;
+}
+
 // termRemoveAliases
 //
 // Substitutes all aliases in term t with the corresponding terms. Returns 0 if
@@ -733,19 +2390,19 @@ int termRemoveAliases(TERM *t, char *id) {
 
 		switch(t->type) {
 			case(TM_ABSTR):
-				termPush(t->rterm);
+				termPush(RTERM(t));
 				todo++;
 				break;
 
 			case(TM_APPL):
-				termPush(t->lterm);
-				termPush(t->rterm);
+				termPush(LTERM(t));
+				termPush(RTERM(t));
 				todo += 2;
 				break;
 
 			case(TM_ALIAS):
-				if(!id || id == t->name)
-					termAliasSubst(t);
+				if(!id || id == NAME(t))
+					termAliasSubst(t, 0);
 				else
 					undefined = 1;
 				
@@ -772,20 +2429,21 @@ void termAlias2Var(TERM *t, char *alias, char *var) {
 
 		switch(t->type) {
 			case(TM_ABSTR):
-				t = t->rterm;
+				t = RTERM(t);
 				todo++;
 				continue;
 
 			case(TM_APPL):
-				termPush(t->lterm);
-				t = t->rterm;
+				termPush(LTERM(t));
+				t = RTERM(t);
 				todo += 2;
 				continue;
 
 			case(TM_ALIAS):
-				if(alias == t->name) {
+				if(alias == NAME(t)) {
 					t->type = TM_VAR;
-					t->name = var;		// already interned
+					SET_NAME(t, var);		// already interned
+					t->index = VAR_NAMED;	// bound by name in termSetClosedFlag
 				}
 				break;
 
@@ -796,21 +2454,19 @@ void termAlias2Var(TERM *t, char *alias, char *var) {
 }
 
 void termRemoveOper(TERM *t) {
-	static char* str_tilde = NULL;
-	if(str_tilde == NULL)
-		str_tilde = str_intern("~");
+	char *str_tilde = str_symbol(SYM_TILDE);
 
 	for(int todo = 1; todo > 0; todo--) {
 		if(!t)
 			t = termPop();
 
 		if(t->type == TM_ABSTR) {
-			t = t->rterm;
+			t = RTERM(t);
 			todo++;
 
 		} else if(t->type == TM_APPL) {
-			TERM *next = t->lterm;
-			termPush(t->rterm);
+			TERM *next = LTERM(t);
+			termPush(RTERM(t));
 
 			//	If t has a name the it's an operator. In this case we perform the conversion:
 			//		a op b -> 'op' a b
@@ -818,25 +2474,27 @@ void termRemoveOper(TERM *t) {
 			//	Operator '~' has a special meaning, used during execution to decide the evaluation
 			//	order.
 			//
-			if(t->name && t->name != str_tilde) {
+			if(NAME(t) && NAME(t) != str_tilde) {
 				// alias = op
 				TERM *alias = termNew();
 				alias->type = TM_ALIAS;
-				alias->name = t->name;
+				COPY_NAME(alias, t);
 				alias->closed = 1;							// aliases are closed terms
-				t->name = NULL;
+				alias->index = VAR_FREE;
+				SET_NAME(t, NULL);
 
 				// apple = op a
 				TERM *appl = termNew();
 				appl->type = TM_APPL;
-				appl->name = NULL;
+				SET_NAME(appl, NULL);
 
-				appl->lterm = alias;
-				appl->rterm = t->lterm;
-				appl->closed = appl->rterm->closed;		// the application "op a" is closed if a is closed
+				SET_LTERM(appl, alias);
+				SET_RTERM(appl, LTERM(t));
+				appl->closed = RTERM(appl)->closed;		// the application "op a" is closed if a is closed
+				appl->index = RTERM(appl)->index;
 
 				// t = (op a) b
-				t->lterm = appl;
+				SET_LTERM(t, appl);
 			}
 
 			t = next;
@@ -848,6 +2506,12 @@ void termRemoveOper(TERM *t) {
 	}
 }
 
+// termSetClosedFlag
+//
+// Computes the closed flag of t and all its subterms. Variables created by the
+// parser (index VAR_NAMED) are bound by name to the nearest abstraction, and get
+// their de Bruijn index (or VAR_FREE), see parser.h.
+
 void termSetClosedFlag(TERM *t) {
 	// Note: in the stack we keep both the "active" terms currently being visited, and the "pending" terms
 	// that will be visited in the future (eg a right branch while we visit the left). The active terms
@@ -870,24 +2534,59 @@ void termSetClosedFlag(TERM *t) {
 
 		// entering term t, terms are closed until we show otherwise
 		t->closed = 1;
+		if(t->type != TM_VAR) {
+			t->index = VAR_FREE;
+			FREE_MASK(t) = 0;
+		}
 
 		switch(t->type) {
 			case(TM_VAR):
 				t->closed = 0;
 
 				// mark all active terms in the stack as not closed, from the most
-				// nested going outwards. Stop if we find an abstraction with the same name.
+				// nested going outwards. Stop if we find the abstraction binding the
+				// variable, which is the one with the same name if not resolved yet.
 				//
+				int named = t->index == VAR_NAMED,
+					depth = 0;				// abstractions between t and ancestor
+				if(named)
+					t->index = VAR_FREE;	// unless we find an abstraction with the same name
+
 				for(int i = termStackSize(); i > init_size; i--) {
 					TERM *ancestor = _termStack[i-1];
 					if(ancestor)
 						continue;	// no active marker, this is a pending term
 
 					ancestor = _termStack[--i-1];
-					if(ancestor->type == TM_ABSTR && ancestor->name == t->name)
-						break;
-					else
-						ancestor->closed = 0;
+					if(ancestor->type == TM_ABSTR) {
+						if(named ? NAME(ancestor) == NAME(t) : t->index == depth) {
+							t->index = depth;
+							break;
+						}
+						depth++;
+					}
+					ancestor->closed = 0;
+				}
+
+				// for bound variables, update the largest index and the free mask of
+				// the ancestors up to the binder (in the loop above, we didn't know
+				// the index yet)
+				termUpdateFree(t);
+				for(int i = termStackSize(), d = 0; t->index >= 0 && i > init_size; i--) {
+					TERM *ancestor = _termStack[i-1];
+					if(ancestor)
+						continue;
+
+					ancestor = _termStack[--i-1];
+					if(ancestor->type == TM_ABSTR) {
+						if(d == t->index)
+							break;
+						d++;
+					}
+					if(ancestor->index < t->index - d)
+						ancestor->index = t->index - d;
+					if(t->index - d < FREE_BITS)
+						FREE_MASK(ancestor) |= 1u << (t->index - d);
 				}
 				break;
 
@@ -896,43 +2595,273 @@ void termSetClosedFlag(TERM *t) {
 				break;
 
 			case(TM_ABSTR):
-				termPush(t->rterm);
+				termPush(RTERM(t));
 				break;
 
 			case(TM_APPL):
-				termPush(t->rterm);
-				termPush(t->lterm);
+				termPush(RTERM(t));
+				termPush(LTERM(t));
 				break;
+
+			case(TM_SUBST):			// closures only exist during execution
+				assert(0);
 		}
 	}
 }
 
-// Finds a variable not contained in lists l1 and l2, by trying all strings in
-// the following order:
+// Returns the (interned) name number n >= 0 in the following order:
 //		a, b, ..., z, aa, ab, .., ba, bb, ..., zz, aaa, aab, ...
 
-static char *getVariable(TERM *t1, TERM *t2) {
-	char s[10] = "a";
-	int curLen = 1, i;
+static char *variableName(int n) {
+	char s[16];
+	int len = sizeof(s) - 1;
+
+	// the letters are the digits of n+1 in base 26 (with digits 1..26), built from the last one
+	s[len] = '\0';
+	do {
+		s[--len] = 'a' + n % 26;
+		n = n / 26 - 1;
+	} while(n >= 0);
+
+	return str_intern(s + len);
+}
+
+// Finds a name for an abstraction (or closure) t, which does not capture any
+// variable of t bound outside it. The names used in t are collected once,
+// then the first name of variableName which is not among them is returned.
+
+static char *getVariable(TERM *t) {
+	usedNames = symtab_create(NULL);
+	termUsesName(t, NULL, -1);
+
+	char *name;
+	for(int n = 0; symtab_find(usedNames, name = variableName(n)) != NULL; n++)
+		;
+
+	symtab_destroy(usedNames);
+	usedNames = NULL;
+	return name;
+}
+
+// Readback
+//
+// The evaluators which do not rewrite the term (nbe.c, machine.c, inet.c)
+// build its normal form from scratch. Variables of the new term are bound by
+// name (VAR_NAMED) and resolved by termSetClosedFlag, so the name of a new
+// abstraction must not be free in the term, nor bound by an enclosing
+// abstraction, otherwise it would capture the corresponding variable. Once
+// resolved, abstractions get back their original name, and termPrint renames
+// them only if they really capture something, as for the other strategies.
+
+static Map readbackNames = NULL;		// name => number of variables using it
+static Map readbackHints = NULL;		// name of an abstraction => original name
+static int readbackDepth;				// nested calls, see readbackNest
+
+// The evaluators recurse on the C stack when reading back (and nbe.c, machine.c
+// when evaluating arguments), each level needs about 128 bytes of it. The
+// normal form of a divergent term can be nested without bound, so the
+// evaluation fails instead of overflowing the stack.
+#define READBACK_MAX_DEPTH	50000
+
+static int compare_pointers(Pointer a, Pointer b) {
+	return a - b;
+}
+
+static int nameUses(char *name) {
+	return (intptr_t)map_find(readbackNames, name);
+}
+
+static void useName(char *name, int diff) {
+	map_insert(readbackNames, name, (Pointer)(intptr_t)(nameUses(name) + diff));
+}
+
+// Adds the free variables of t to the used names
+
+static void useFreeNames(TERM *t) {
+	if(t->closed)
+		return;
+
+	switch(t->type) {
+	 case TM_VAR:
+		if(t->index == VAR_FREE && nameUses(NAME(t)) == 0)
+			useName(NAME(t), 1);
+		break;
+
+	 case TM_ABSTR:
+		useFreeNames(RTERM(t));
+		break;
+
+	 case TM_APPL:
+		useFreeNames(LTERM(t));
+		useFreeNames(RTERM(t));
+		break;
+
+	 case TM_ALIAS:
+	 case TM_SUBST:
+		break;
+	}
+}
+
+// Performs the eta-reductions \x.M x -> M of t which normal order does before
+// reducing inside M, this decides the names of the abstractions left
+// (\x.(\y.y) x gives \y.y, not \x.x). Only the bodies of abstractions and
+// the arguments of a variable are searched, an abstraction anywhere else
+// might be beta-reduced first. Returns their number.
 
-	// build strings until we find one not contained in one of the lists
-	while(termIsFreeVar(t1, s) || termIsFreeVar(t2, s)) {
-		// increment the last character. When it becomes 'z' we change it to 'a'
-		// and continue incrementing the previous character, etc (after "az" we
-		// have "ba").
-		for(i = curLen-1; i >= 0 && ++s[i] == 'z'; i--)
-			s[i] = 'a';
+static int etaReduce(TERM *t) {
+	int n = 0;
 
-		// if all characters became 'z' we need to increase the size of the string,
-		// and start from 'aa...'
-		if(i < 0) {
-			s[curLen] = 'a';
-			s[++curLen] = '\0';
+	switch(t->type) {
+	 case TM_ABSTR:
+		if(termIsEtaRedex(t, 0)) {
+			// M is moved outside the abstraction, as in termConv
+			TERM *L = termOwnR(t);
+			TERM *M = termOwnL(L);
+			termShift(M, -1, 0);
+			*t = *M;
+			SET_LTERM(M, NULL); SET_RTERM(M, NULL);
+			termFree(L);
+			return 1 + etaReduce(t);
 		}
+		return etaReduce(termOwnR(t));
+
+	 case TM_APPL: {
+		TERM *head = t;
+		while(head->type == TM_APPL)
+			head = LTERM(head);
+		if(head->type != TM_VAR)
+			return 0;
+
+		for(; t->type == TM_APPL; t = termOwnL(t))
+			n += etaReduce(termOwnR(t));
+		return n;
+	 }
+
+	 default:
+		return 0;
+	}
+}
+
+// readbackInit
+//
+// Starts the readback of the normal form of t, after the eta-reductions
+// which normal order would do first. Returns their number.
+
+int readbackInit(TERM *t) {
+	int n = etaReduce(t);
+	if(n > 0)
+		termSetClosedFlag(t);
+
+	readbackDepth = 0;
+	readbackNames = map_create(compare_pointers, NULL, NULL);
+	map_set_hash_function(readbackNames, hash_pointer);
+	readbackHints = map_create(compare_pointers, NULL, NULL);
+	map_set_hash_function(readbackHints, hash_pointer);
+	useFreeNames(t);
+	return n;
+}
+
+// readbackBind
+//
+// Returns the name of a new abstraction: name itself if it captures nothing,
+// otherwise the first name in the order of variableName which is not used, and
+// has never stood for another name. The name is used until readbackUnbind is
+// called.
+
+char *readbackBind(char *name) {
+	char *hint = name,
+		 *other = map_find(readbackHints, name);
+
+	if(nameUses(name) > 0 || (other != NULL && other != name))
+		for(int n = 0; nameUses(name = variableName(n)) > 0 || map_find(readbackHints, name) != NULL; n++)
+			;
+
+	map_insert(readbackHints, name, hint);
+	useName(name, 1);
+	return name;
+}
+
+void readbackUnbind(char *name) {
+	useName(name, -1);
+}
+
+// readbackNest
+//
+// Called by the evaluators before each nested call, and readbackUnnest after
+// it (also when the call was not made). Sets *error if the calls are nested
+// too deeply, the error is printed only once. Returns 0 if *error is set.
+
+int readbackNest(int *error) {
+	if(++readbackDepth > READBACK_MAX_DEPTH && !*error) {
+		printf("Error: the evaluation is nested too deeply, try another strategy.\n");
+		*error = 1;
 	}
+	return !*error;
+}
+
+void readbackUnnest() {
+	readbackDepth--;
+}
+
+TERM *readbackTerm(TERM_TYPE type, char *name, TERM *lterm, TERM *rterm) {
+	TERM *t = termNew();
+	t->type = type;
+	SET_NAME(t, name);
+	t->index = VAR_NAMED;		// bound by name in termSetClosedFlag
+	SET_LTERM(t, lterm);
+	SET_RTERM(t, rterm);
+	t->closed = 0;
+	return t;
+}
+
+// Gives back their original name to the abstractions of t, and to the
+// variables they bind (which are already resolved)
+
+static void restoreNames(TERM *t) {
+	char *hint;
 
-	// string found, return a copy
-	return str_intern(s);
+	switch(t->type) {
+	 case TM_VAR:
+		if(t->index >= 0 && (hint = map_find(readbackHints, NAME(t))) != NULL)
+			SET_NAME(t, hint);
+		break;
+
+	 case TM_ABSTR:
+		if((hint = map_find(readbackHints, NAME(t))) != NULL)
+			SET_NAME(t, hint);
+		restoreNames(RTERM(t));
+		break;
+
+	 case TM_APPL:
+		restoreNames(LTERM(t));
+		restoreNames(RTERM(t));
+		break;
+
+	 case TM_ALIAS:
+	 case TM_SUBST:
+		break;
+	}
 }
 
+// readbackFinish
+//
+// Replaces t with its normal form res (if not NULL, that is if no error happened)
+
+void readbackFinish(TERM *t, TERM *res) {
+	if(res != NULL) {
+		termSetClosedFlag(res);
+		restoreNames(res);
+
+		// the old contents of t are moved to a new term which is freed
+		TERM *old = termNew();
+		*old = *t;
+		*t = *res;
+		SET_LTERM(res, NULL); SET_RTERM(res, NULL);
+		termFree(res);
+		termFree(old);
+	}
 
+	map_destroy(readbackNames);
+	map_destroy(readbackHints);
+	readbackNames = readbackHints = NULL;
+}
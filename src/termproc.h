@@ -8,11 +8,22 @@
 
 void termPrint(TERM *t, int isMostRight);
 TERM *termNew();
+int termSetFile(char *path);
 void termFree(TERM *t);
 void termGC();
+void termFreeAll();
+void termStats(int *chunkCount, int *peak);
+void termCompactStats(int *count, double *seconds);
+int termCompact(TERM *t);
+int termTrim(int keep);
+void termPoolStats(unsigned long *hits, unsigned long *misses);
 TERM *termClone(TERM *t);
+TERM *termFreeze(TERM *t);
+void termThaw(TERM *t);
+void termConsClear();
 
 int termConv(TERM *t);
+void termConvReset();
 
 int termNumber(TERM *t);
 
@@ -21,4 +32,12 @@ void termAlias2Var(TERM *t, char *alias, char *var);
 
 void termRemoveOper(TERM *t);
 void termSetClosedFlag(TERM *t);
-
+void termUpdateFree(TERM *t);
+
+int readbackInit(TERM *t);
+char *readbackBind(char *name);
+void readbackUnbind(char *name);
+int readbackNest(int *error);
+void readbackUnnest();
+TERM *readbackTerm(TERM_TYPE type, char *name, TERM *lterm, TERM *rterm);
+void readbackFinish(TERM *t, TERM *res);